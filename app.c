@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <unistd.h>
+#include "app.h"
 #include "devices.h"
+#include "instr.h"
 #include "link.h"
 #include "log.h"
 #include "sleep.h"
+#include "stats.h"
+#include "timing.h"
 #include "updi.h"
 
 void APP_Reset(bool apply_reset)
@@ -30,40 +34,55 @@ bool APP_InProgMode(void)
 
 bool APP_WaitUnlocked(uint16_t timeout_ms)
 {
+  uint64_t deadline = STATS_GetTime() + (uint64_t)timeout_ms * 1000;
 
   //Waits for the device to be unlocked.
   //All devices boot up as locked until proven otherwise
-
-  while (timeout_ms-- > 0)
+  //One LDCS takes a few byte times, so it is polled back to back
+  do
   {
-    msleep(1);
     if (!(LINK_ldcs(UPDI_ASI_SYS_STATUS) & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS)))
       return true;
-  }
+  } while (STATS_GetTime() < deadline);
 
   LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for device to unlock");
   return false;
 }
 
+static bool APP_WaitProgmode(uint16_t timeout_ms, uint8_t *status)
+{
+  uint64_t deadline = STATS_GetTime() + (uint64_t)timeout_ms * 1000;
+
+  //Waits for the device to be unlocked and in NVM programming mode,
+  //the part may still be leaving reset. Polled back to back as well
+  do
+  {
+    *status = LINK_ldcs(UPDI_ASI_SYS_STATUS);
+    if (!(*status & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS)) && (*status & (1 << UPDI_ASI_SYS_STATUS_NVMPROG)))
+      return true;
+  } while (STATS_GetTime() < deadline);
+
+  return false;
+}
+
 bool APP_EnterProgmode(void)
 {
   //Enters into NVM programming mode
   uint8_t key_status;
+  uint8_t status;
 
   //First check if NVM is already enabled
   if (APP_InProgMode() == true)
   {
     LOG_Print(LOG_LEVEL_WARNING, "Already in NVM programming mode");
+    STATS_Connected();
     return true;
   }
 
   LOG_Print(LOG_LEVEL_WARNING, "Entering NVM programming mode");
 
-  // Put in the key
-  LINK_SendKey(UPDI_KEY_NVM, UPDI_KEY_64);
-
-  // Check key status
-  key_status = LINK_ldcs(UPDI_ASI_KEY_STATUS);
+  // Put in the key and check key status
+  key_status = LINK_SendKeyStatus(UPDI_KEY_NVM, UPDI_KEY_64);
   LOG_Print(LOG_LEVEL_INFO, "Key status = 0x%02X", key_status);
 
   if (!(key_status & (1 << UPDI_ASI_KEY_STATUS_NVMPROG)))
@@ -72,25 +91,21 @@ bool APP_EnterProgmode(void)
     return false;
   }
 
-  // Toggle reset
-  APP_Reset(true);
-  APP_Reset(false);
-
-  // And wait for unlock
-  if (!APP_WaitUnlocked(100))
-  {
-    LOG_Print(LOG_LEVEL_ERROR, "Failed to enter NVM programming mode: device is locked");
-    return false;
-  }
+  // Toggle reset, the first status comes with it
+  status = LINK_ResetStatus(UPDI_ASI_SYS_STATUS);
 
-  // Check for NVMPROG flag
-  if (APP_InProgMode() == false)
+  // Polls are skipped only if the first status is unlocked and in programming mode
+  if (((status & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS)) || !(status & (1 << UPDI_ASI_SYS_STATUS_NVMPROG))) &&
+      !APP_WaitProgmode(100, &status))
   {
-    LOG_Print(LOG_LEVEL_ERROR, "Failed to enter NVM programming mode");
+    if (status & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS))
+      LOG_Print(LOG_LEVEL_ERROR, "Failed to enter NVM programming mode: device is locked");
+    else
+      LOG_Print(LOG_LEVEL_ERROR, "Failed to enter NVM programming mode");
     return false;
   }
 
-  LOG_Print(LOG_LEVEL_INFO, "Now in NVM programming mode");
+  LOG_Print(LOG_LEVEL_INFO, "Now in NVM programming mode, %.1f ms after port open", STATS_Connected() / 1000.0);
   return true;
 }
 
@@ -108,11 +123,8 @@ bool APP_Unlock(void)
   //Unlock and erase
   uint8_t key_status;
 
-  // Put in the key
-  LINK_SendKey(UPDI_KEY_CHIPERASE, UPDI_KEY_64);
-
-  // Check key status
-  key_status = LINK_ldcs(UPDI_ASI_KEY_STATUS);
+  // Put in the key and check key status
+  key_status = LINK_SendKeyStatus(UPDI_KEY_CHIPERASE, UPDI_KEY_64);
   LOG_Print(LOG_LEVEL_INFO, "Key status = 0x%02X", key_status);
 
   if (!(key_status & (1 << UPDI_ASI_KEY_STATUS_CHIPERASE)))
@@ -121,52 +133,156 @@ bool APP_Unlock(void)
     return false;
   }
 
+  // Toggle reset, and wait for unlock
+  if ((LINK_ResetStatus(UPDI_ASI_SYS_STATUS) & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS)) && !APP_WaitUnlocked(100))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Failed to chip erase using key!");
+    return false;
+  }
+
+  return true;
+}
+
+bool APP_WaitUserRowProg(uint16_t timeout_ms, bool wait_for_high)
+{
+  //Waits for the UROWPROG flag to be set or cleared
+  bool state;
+
+  while (timeout_ms-- > 0)
+  {
+    msleep(1);
+    state = (LINK_ldcs(UPDI_ASI_SYS_STATUS) & (1 << UPDI_ASI_SYS_STATUS_UROWPROG)) ? true : false;
+    if (state == wait_for_high)
+      return true;
+  }
+
+  LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for user row programming");
+  return false;
+}
+
+bool APP_WriteUserRowLocked(uint16_t address, uint8_t *data, uint16_t len)
+{
+  //Writes the user row of a locked device using the UROWWRITE key
+  uint8_t key_status;
+
+  // Put in the key and check key status
+  key_status = LINK_SendKeyStatus(UPDI_KEY_UROW, UPDI_KEY_64);
+  LOG_Print(LOG_LEVEL_INFO, "Key status = 0x%02X", key_status);
+
+  if (!(key_status & (1 << UPDI_ASI_KEY_STATUS_UROWWRITE)))
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Key not accepted");
+    return false;
+  }
+
   // Toggle reset
   APP_Reset(true);
   APP_Reset(false);
 
-  // And wait for unlock
-  if (!APP_WaitUnlocked(100))
+  // Wait for user row programming mode
+  if (!APP_WaitUserRowProg(500, true))
   {
-    LOG_Print(LOG_LEVEL_ERROR, "Failed to chip erase using key!");
+    LOG_Print(LOG_LEVEL_ERROR, "Failed to enter user row programming mode");
     return false;
   }
 
+  // Data goes to the user row address, it is committed by UROW_FINAL
+  if (!APP_WriteData(address, data, len))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Failed to write user row data");
+    return false;
+  }
+  LINK_stcs(UPDI_ASI_SYS_CTRLA, (1 << UPDI_ASI_SYS_CTRLA_UROW_FINAL) | (1 << UPDI_ASI_SYS_CTRLA_CLKREQ));
+
+  // And wait for it
+  if (!APP_WaitUserRowProg(500, false))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Failed to finish user row programming");
+    return false;
+  }
+
+  // Release the key and reset
+  LINK_stcs(UPDI_ASI_KEY_STATUS, (1 << UPDI_ASI_KEY_STATUS_UROWWRITE) | (1 << UPDI_ASI_KEY_STATUS_NVMPROG));
+  APP_Reset(true);
+  APP_Reset(false);
+
   return true;
 }
 
 bool APP_WaitFlashReady(void)
 {
-  //Waits for the NVM controller to be ready
+  //Waits for the NVM controller to be ready. Polls of the
+  //running command start shortly before its expected time
   uint8_t status;
-  uint16_t timeout = 10000; // 10 sec timeout, just to be sure
+  uint32_t interval;
+  uint64_t poll = TIMING_Schedule(&interval);
+  uint64_t now = STATS_GetTime();
+  uint64_t deadline = now + TIMING_TIMEOUT_US;
+  INSTR_TIME(start);
 
   LOG_Print(LOG_LEVEL_INFO, "Wait flash ready");
-  while (timeout-- > 0)
+  while (now < deadline)
   {
-    msleep(1);
+    if (poll > now + 1000)
+      msleep((uint32_t)((poll - now) / 1000));
     status = LINK_ld(DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_STATUS);
     if (status & (1 << UPDI_NVM_STATUS_WRITE_ERROR))
     {
       LOG_Print(LOG_LEVEL_ERROR, "NVM error");
+      TIMING_Finish(false);
+      INSTR_RECORD(INSTR_NVM_BUSY, 0, start);
       return false;
     }
 
     if (!(status & ((1 << UPDI_NVM_STATUS_EEPROM_BUSY) | (1 << UPDI_NVM_STATUS_FLASH_BUSY))))
+    {
+      TIMING_Finish(true);
+      INSTR_RECORD(INSTR_NVM_BUSY, 0, start);
       return true;
+    }
+    now = STATS_GetTime();
+    poll = now + interval;
   }
 
   LOG_Print(LOG_LEVEL_WARNING, "Waiting for flash ready timed out");
+  TIMING_Finish(false);
+  INSTR_RECORD(INSTR_NVM_BUSY, 0, start);
+  INSTR_TIMEOUT(INSTR_NVM_BUSY);
 
   return false;
 }
 
+static bool APP_ExecuteNvmTimed(uint8_t command, uint8_t op)
+{
+  //Executes an NVM COMMAND timed as the given operation
+  //The command runs from its ACK, this is the start of its timing,
+  //a NACKed command is not timed
+  bool res;
+
+  LOG_Print(LOG_LEVEL_INFO, "NVMCMD %d executing", command);
+  res = LINK_st(DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_CTRLA, command);
+  TIMING_Start((res == true) ? op : TIMING_NONE);
+  return res;
+}
+
 bool APP_ExecuteNvmCommand(uint8_t command)
 {
   //Executes an NVM COMMAND on the NVM CTRL
   //self.logger.info("NVMCMD {:d} executing".format(command))
-  LOG_Print(LOG_LEVEL_INFO, "NVMCMD %d executing", command);
-  return LINK_st(DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_CTRLA, command);
+  return APP_ExecuteNvmTimed(command, TIMING_GetOperation(command));
+}
+
+bool APP_WriteFuse(uint16_t address, uint8_t value)
+{
+  //Writes one fuse, DATA and ADDR registers are adjacent
+  //so they are loaded with a single burst
+  uint8_t regs[] = {value, 0x00, (uint8_t)(address & 0xff), (uint8_t)(address >> 8)};
+
+  LOG_Print(LOG_LEVEL_INFO, "Write fuse at 0x%04X", address);
+  if (APP_WriteData(DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_DATAL, regs, sizeof(regs)) == false)
+    return false;
+
+  return APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_WRITE_FUSE);
 }
 
 bool APP_ChipErase(void)
@@ -196,6 +312,44 @@ bool APP_ChipErase(void)
   return true;
 }
 
+bool APP_CrcScan(bool *crc_ok)
+{
+  //Runs CRCSCAN over the whole flash, the checksum has to be
+  //stored in the last two bytes of flash for the scan to pass
+  uint16_t address = DEVICES_GetCrcscanAddress();
+  uint16_t timeout = 1000;
+  uint8_t status;
+
+  if (address == 0)
+  {
+    LOG_Print(LOG_LEVEL_INFO, "No usable CRCSCAN on this device");
+    return false;
+  }
+
+  LOG_Print(LOG_LEVEL_INFO, "CRC scan of flash");
+  // Reset the peripheral, CTRLB can be written only while disabled
+  if (!LINK_st(address + UPDI_CRCSCAN_CTRLA, 1 << UPDI_CRCSCAN_CTRLA_RESET_BIT))
+    return false;
+  if (!LINK_st(address + UPDI_CRCSCAN_CTRLB, UPDI_CRCSCAN_CTRLB_SRC_FLASH))
+    return false;
+  if (!LINK_st(address + UPDI_CRCSCAN_CTRLA, 1 << UPDI_CRCSCAN_CTRLA_ENABLE_BIT))
+    return false;
+
+  while (timeout-- > 0)
+  {
+    status = LINK_ld(address + UPDI_CRCSCAN_STATUS);
+    if (!(status & (1 << UPDI_CRCSCAN_STATUS_BUSY_BIT)))
+    {
+      *crc_ok = (status & (1 << UPDI_CRCSCAN_STATUS_OK_BIT)) ? true : false;
+      return true;
+    }
+    msleep(1);
+  }
+
+  LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for CRC scan");
+  return false;
+}
+
 bool APP_WriteDataWords(uint16_t address, uint8_t *data, uint16_t len)
 {
   //Writes a number of words to memory
@@ -252,12 +406,13 @@ bool APP_WriteData(uint16_t address, uint8_t *data, uint16_t len)
   return LINK_st_ptr_inc(data, len);
 }
 
-bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_access)
+bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_access, bool erase)
 {
   //Writes a page of data to NVM.APP_ExecuteNvmCommand
-  //By default the PAGE_WRITE command is used, which
+  //Without erase the PAGE_WRITE command is used, which
   //requires that the page is already erased.
   //By default word access is used (flash)
+  bool res;
 
   // Check that NVM controller is ready
   if (!APP_WaitFlashReady())
@@ -268,7 +423,8 @@ bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_a
 
   // Clear the page buffer
   LOG_Print(LOG_LEVEL_INFO, "Clear page buffer");
-  APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_PAGE_BUFFER_CLR);
+  if (APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_PAGE_BUFFER_CLR) == false)
+    return false;
 
   // Waif for NVM controller to be ready
   if (!APP_WaitFlashReady())
@@ -277,15 +433,76 @@ bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_a
     return false;
   }
 
-  // Load the page buffer by writing directly to location
+  // Load the page buffer by writing directly to location, a missing ACK means the link is gone
   if (use_word_access == true)
-    APP_WriteDataWords(address, data, len);
+    res = APP_WriteDataWords(address, data, len);
   else
-    APP_WriteData(address, data, len);
+    res = APP_WriteData(address, data, len);
+  if (res == false)
+    return false;
 
   // Write the page to NVM, maybe erase first
   LOG_Print(LOG_LEVEL_INFO, "Committing page");
-  APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_WRITE_PAGE);
+  if (APP_ExecuteNvmCommand((erase == true) ? UPDI_NVMCTRL_CTRLA_ERASE_WRITE_PAGE : UPDI_NVMCTRL_CTRLA_WRITE_PAGE) == false)
+    return false;
+
+  // Wait for NVM controller to be ready again
+  if (!APP_WaitFlashReady())
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for flash ready after page write");
+    return false;
+  }
+
+  return true;
+}
+
+bool APP_WriteNvmDiff(uint16_t address, uint8_t *data, uint8_t *current, uint16_t len)
+{
+  //Writes a page of byte-erasable NVM (EEPROM, user row).
+  //ERASE_WRITE_PAGE touches only the bytes loaded into the page
+  //buffer, so only bytes that differ from current content are loaded
+  uint16_t i;
+  uint16_t start;
+
+  // Check that NVM controller is ready
+  if (!APP_WaitFlashReady())
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for flash ready before page buffer clear ");
+    return false;
+  }
+
+  // Clear the page buffer
+  LOG_Print(LOG_LEVEL_INFO, "Clear page buffer");
+  if (APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_PAGE_BUFFER_CLR) == false)
+    return false;
+
+  // Waif for NVM controller to be ready
+  if (!APP_WaitFlashReady())
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for flash ready after page buffer clear");
+    return false;
+  }
+
+  // Load runs of changed bytes
+  i = 0;
+  while (i < len)
+  {
+    if (data[i] == current[i])
+    {
+      i++;
+      continue;
+    }
+    start = i;
+    while ((i < len) && (data[i] != current[i]) && (i - start <= UPDI_MAX_REPEAT_SIZE))
+      i++;
+    if (APP_WriteData(address + start, &data[start], i - start) == false)
+      return false;
+  }
+
+  // Erase and write the loaded bytes, it takes longer than on flash
+  LOG_Print(LOG_LEVEL_INFO, "Committing page");
+  if (APP_ExecuteNvmTimed(UPDI_NVMCTRL_CTRLA_ERASE_WRITE_PAGE, TIMING_EEPROM_WRITE) == false)
+    return false;
 
   // Wait for NVM controller to be ready again
   if (!APP_WaitFlashReady())
@@ -297,6 +514,35 @@ bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_a
   return true;
 }
 
+bool APP_ErasePage(uint16_t address)
+{
+  //Erases one flash page. The page is selected by a
+  //dummy write into the page buffer at its address
+  uint8_t dummy = 0xFF;
+
+  // Check that NVM controller is ready
+  if (!APP_WaitFlashReady())
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for flash ready before page erase");
+    return false;
+  }
+
+  LOG_Print(LOG_LEVEL_INFO, "Erasing page at 0x%04X", address);
+  if (APP_WriteData(address, &dummy, 1) == false)
+    return false;
+  if (APP_ExecuteNvmCommand(UPDI_NVMCTRL_CTRLA_ERASE_PAGE) == false)
+    return false;
+
+  // Wait for NVM controller to be ready again
+  if (!APP_WaitFlashReady())
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Timeout by waiting for flash ready after page erase");
+    return false;
+  }
+
+  return true;
+}
+
 bool APP_ReadData(uint16_t address, uint8_t *data, uint16_t size)
 {
   //Reads a number of bytes of data from UPDI
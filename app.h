@@ -8,9 +8,15 @@ bool APP_EnterProgmode(void);
 void APP_LeaveProgmode(void);
 bool APP_WaitFlashReady(void);
 bool APP_Unlock(void);
+bool APP_WriteUserRowLocked(uint16_t address, uint8_t *data, uint16_t len);
 bool APP_ChipErase(void);
+bool APP_CrcScan(bool *crc_ok);
+bool APP_WriteFuse(uint16_t address, uint8_t value);
+bool APP_ReadData(uint16_t address, uint8_t *data, uint16_t size);
 bool APP_ReadDataWords(uint16_t address, uint8_t *data, uint16_t words);
 bool APP_WriteData(uint16_t address, uint8_t *data, uint16_t len);
-bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_access);
+bool APP_WriteNvm(uint16_t address, uint8_t *data, uint16_t len, bool use_word_access, bool erase);
+bool APP_WriteNvmDiff(uint16_t address, uint8_t *data, uint8_t *current, uint16_t len);
+bool APP_ErasePage(uint16_t address);
 
 #endif
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include "bin.h"
+
+/** \brief Write data buffer to raw binary file
+ *
+ * \param [in] fp File handle
+ * \param [in] data Data buffer to write
+ * \param [in] len Length of data buffer
+ * \return error code as uint8_t
+ *
+ */
+uint8_t BIN_WriteFile(FILE *fp, uint8_t *data, uint16_t len)
+{
+  if (fwrite(data, 1, len, fp) != len)
+    return BIN_ERROR_FILE;
+
+  return BIN_ERROR_NONE;
+}
+
+/** \brief Read raw binary file to a memory buffer
+ *
+ * \param [in] fp File handler
+ * \param [out] data Data buffer to read data into
+ * \param [in] maxlen Maximal data length
+ * \param [in] offset Load offset of the file contents in the buffer
+ * \param [out] min_addr Minimal address with non-empty data
+ * \param [out] max_addr Maximal address with non-empty data
+ * \return error code as uint8_t
+ *
+ */
+uint8_t BIN_ReadFile(FILE *fp, uint8_t *data, uint16_t maxlen, uint16_t offset,
+                     uint16_t *min_addr, uint16_t *max_addr)
+{
+  size_t len;
+  size_t i;
+
+  if (offset >= maxlen)
+    return BIN_ERROR_SIZE;
+
+  len = fread(&data[offset], 1, maxlen - offset, fp);
+  if (ferror(fp))
+    return BIN_ERROR_FILE;
+  // anything left means the file doesn't fit into memory
+  if (fgetc(fp) != EOF)
+    return BIN_ERROR_SIZE;
+
+  for (i = 0; i < len; i++)
+  {
+    if (data[offset + i] != 0xFF)
+    {
+      *max_addr = offset + i + 1;
+      if (offset + i < *min_addr)
+        *min_addr = offset + i;
+    }
+  }
+
+  return BIN_ERROR_NONE;
+}
@@ -0,0 +1,18 @@
+#ifndef BIN_H
+#define BIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+enum {
+  BIN_ERROR_NONE,
+  BIN_ERROR_FILE,
+  BIN_ERROR_SIZE
+};
+
+uint8_t BIN_WriteFile(FILE *fp, uint8_t *data, uint16_t len);
+uint8_t BIN_ReadFile(FILE *fp, uint8_t *data, uint16_t maxlen, uint16_t offset,
+                     uint16_t *min_addr, uint16_t *max_addr);
+
+#endif
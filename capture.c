@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "log.h"
+#include "session.h"
+#include "stats.h"
+#include "updi.h"
+
+/** \brief Write unsigned LEB128 number
+ *
+ * \param [in] fp File handle
+ * \param [in] value Number to write
+ * \return Nothing
+ *
+ */
+static void CAPTURE_PutNumber(FILE *fp, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    fputc((int)(value & 0x7F) | 0x80, fp);
+    value >>= 7;
+  }
+  fputc((int)value, fp);
+}
+
+/** \brief Read unsigned LEB128 number
+ *
+ * \param [in] fp File handle
+ * \param [out] value Number read
+ * \return true if succeed
+ *
+ */
+static bool CAPTURE_GetNumber(FILE *fp, uint64_t *value)
+{
+  uint8_t shift = 0;
+  int c;
+
+  *value = 0;
+  do
+  {
+    if (((c = fgetc(fp)) == EOF) || (shift > 63))
+      return false;
+    *value |= (uint64_t)(c & 0x7F) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return true;
+}
+
+/** \brief Open trace file for reading and check its header
+ *
+ * \param [in] filename Trace file name
+ * \return file handle positioned at the first record, NULL on error
+ *
+ */
+FILE *CAPTURE_OpenTrace(char *filename)
+{
+  FILE *fp;
+  char magic[sizeof(CAPTURE_MAGIC)];
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't open capture file: %s", filename);
+    return NULL;
+  }
+  if ((fread(magic, 1, sizeof(magic), fp) != sizeof(magic)) ||
+      (memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0) || (magic[sizeof(magic) - 1] != CAPTURE_VERSION))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Not a capture file: %s", filename);
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+/** \brief Read next record of the trace
+ *
+ * \param [in] fp Trace file handle
+ * \param [out] record Record, its data is allocated and must be freed by the caller
+ * \return false at the end of the trace
+ *
+ */
+bool CAPTURE_ReadRecord(FILE *fp, tCaptureRecord *record)
+{
+  uint64_t gap, len;
+  int type;
+
+  record->data = NULL;
+  if ((type = fgetc(fp)) == EOF)
+    return false;
+  if ((CAPTURE_GetNumber(fp, &gap) == false) || (CAPTURE_GetNumber(fp, &len) == false) || (len > 0xFFFF) ||
+      ((record->data = malloc(len + 1)) == NULL) || (fread(record->data, 1, len, fp) != len))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Trace is truncated");
+    free(record->data);
+    record->data = NULL;
+    return false;
+  }
+  record->type = (uint8_t)type;
+  record->gap = (uint32_t)gap;
+  record->len = (uint16_t)len;
+  return true;
+}
+
+/** \brief Start capture of all port traffic of the current session,
+ *         sessions opened later from it share the trace
+ *
+ * \param [in] filename Trace file name
+ * \return true if succeed
+ *
+ */
+bool CAPTURE_Start(char *filename)
+{
+  tCapture *capture;
+
+  capture = malloc(sizeof(tCapture));
+  if (capture == NULL)
+    return false;
+  capture->fp = fopen(filename, "wb");
+  if (capture->fp == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't create capture file: %s", filename);
+    free(capture);
+    return false;
+  }
+  fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), capture->fp);
+  fputc(CAPTURE_VERSION, capture->fp);
+  capture->last = STATS_GetTime();
+  SESSION_Current->capture = capture;
+  return true;
+}
+
+/** \brief Finish capture of the current session
+ *
+ * \return Nothing
+ *
+ */
+void CAPTURE_Stop(void)
+{
+  if (SESSION_Current->capture == NULL)
+    return;
+  fclose(SESSION_Current->capture->fp);
+  free(SESSION_Current->capture);
+  SESSION_Current->capture = NULL;
+}
+
+/** \brief Add record to the trace, does nothing if capture is off
+ *
+ * \param [in] type Record type
+ * \param [in] data Record data
+ * \param [in] len Length of data
+ * \return Nothing
+ *
+ */
+void CAPTURE_Record(uint8_t type, uint8_t *data, uint16_t len)
+{
+  tCapture *capture = SESSION_Current->capture;
+  uint64_t now;
+
+  if (capture == NULL)
+    return;
+  now = STATS_GetTime();
+  fputc(type, capture->fp);
+  CAPTURE_PutNumber(capture->fp, now - capture->last);
+  CAPTURE_PutNumber(capture->fp, len);
+  if (len > 0)
+    fwrite(data, 1, len, capture->fp);
+  capture->last = now;
+}
+
+/** \brief Render UPDI frame as instruction text
+ *
+ * \param [out] text Text buffer
+ * \param [in] size Size of text buffer
+ * \param [in] frame Frame starting with SYNC
+ * \param [in] len Length of frame
+ * \return Nothing
+ *
+ */
+static void CAPTURE_Instruction(char *text, size_t size, uint8_t *frame, uint16_t len)
+{
+  static const char *ptr[] = {"*ptr", "*ptr++", "ptr", "?"};
+  uint8_t op = frame[1];
+  uint32_t value = 0;
+  uint16_t i;
+
+  // operand bytes are little endian
+  for (i = len - 1; i >= 2; i--)
+    value = (value << 8) | frame[i];
+  switch (op & 0xE0)
+  {
+    case UPDI_LDS:
+    case UPDI_STS:
+      snprintf(text, size, "%s a%d d%d 0x%04X", ((op & 0xE0) == UPDI_LDS) ? "LDS" : "STS",
+               8 * (((op >> 2) & 0x03) + 1), (op & UPDI_DATA_16) ? 16 : 8, value);
+      break;
+    case UPDI_LD:
+      snprintf(text, size, "LD%d %s", (op & UPDI_DATA_16) ? 16 : 8, ptr[(op >> 2) & 0x03]);
+      break;
+    case UPDI_ST:
+      if ((op & 0x0C) == UPDI_PTR_ADDRESS)
+        snprintf(text, size, "ST ptr = 0x%04X", value);
+      else
+        snprintf(text, size, "ST%d %s 0x%X", (op & UPDI_DATA_16) ? 16 : 8, ptr[(op >> 2) & 0x03], value);
+      break;
+    case UPDI_LDCS:
+      snprintf(text, size, "LDCS 0x%02X", op & 0x0F);
+      break;
+    case UPDI_STCS:
+      snprintf(text, size, "STCS 0x%02X = 0x%02X", op & 0x0F, value);
+      break;
+    case UPDI_REPEAT:
+      snprintf(text, size, "REPEAT %u", value + 1);
+      break;
+    case UPDI_KEY:
+      snprintf(text, size, "KEY %s %d bytes", (op & UPDI_KEY_SIB) ? "read SIB" : "send", 8 << (op & 0x03));
+      break;
+  }
+}
+
+/** \brief Get length of the UPDI frame with its inline operands
+ *
+ * \param [in] frame Frame starting with SYNC
+ * \param [in] len Length of data left in the transfer
+ * \return frame length as uint16_t, not more than len
+ *
+ */
+static uint16_t CAPTURE_FrameLength(uint8_t *frame, uint16_t len)
+{
+  uint8_t op = frame[1];
+  uint16_t n = 2;
+
+  switch (op & 0xE0)
+  {
+    case UPDI_LDS:
+    case UPDI_STS:
+      n += ((op >> 2) & 0x03) + 1;
+      break;
+    case UPDI_ST:
+      n += (op & UPDI_DATA_16) ? 2 : 1;
+      break;
+    case UPDI_STCS:
+      n += 1;
+      break;
+    case UPDI_REPEAT:
+      n += (op & 0x03) + 1;
+      break;
+    case UPDI_KEY:
+      if (!(op & UPDI_KEY_SIB))
+        n += 8 << (op & 0x03);
+      break;
+  }
+  return (n < len) ? n : len;
+}
+
+/** \brief Print data bytes, long blocks are shortened
+ *
+ * \param [in] data Data bytes
+ * \param [in] len Length of data
+ * \return Nothing
+ *
+ */
+static void CAPTURE_PrintData(uint8_t *data, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0; (i < len) && (i < 16); i++)
+    printf(" %02X", data[i]);
+  if (len > 16)
+    printf(" ... (%u bytes)", len);
+}
+
+/** \brief Print trace as UPDI instructions with timestamps and gaps
+ *
+ * \param [in] filename Trace file name
+ * \return true if succeed
+ *
+ */
+bool CAPTURE_Decode(char *filename)
+{
+  FILE *fp;
+  tCaptureRecord record;
+  char text[64];
+  uint8_t *data;
+  uint8_t echo[CAPTURE_ECHO_LEN];
+  uint16_t echo_len = 0;
+  uint16_t len;
+  uint16_t i, n;
+  uint64_t time = 0;
+
+  if ((fp = CAPTURE_OpenTrace(filename)) == NULL)
+    return false;
+  printf("     time ms     gap ms\n");
+  while (CAPTURE_ReadRecord(fp, &record) == true)
+  {
+    data = record.data;
+    len = record.len;
+    time += record.gap;
+    printf("%12.3f %10.3f  ", time / 1000.0, record.gap / 1000.0);
+    switch (record.type)
+    {
+      case CAPTURE_OPEN:
+        printf("OPEN %u baud\n", (len >= 4) ? data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24) : 0);
+        break;
+      case CAPTURE_CLOSE:
+        printf("CLOSE\n");
+        break;
+      case CAPTURE_BREAK:
+        printf("-> line BREAK %.3f ms\n",
+               (len >= 4) ? (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) / 1000.0 : 0);
+        // the break comes back as a zero byte, dropped with the input buffer
+        echo_len = 0;
+        break;
+      case CAPTURE_TX:
+        if ((len >= 2) && (data[0] == UPDI_PHY_SYNC))
+        {
+          printf("->");
+          // several frames may go out in one transfer
+          for (i = 0; (len - i >= 2) && (data[i] == UPDI_PHY_SYNC); i += n)
+          {
+            n = CAPTURE_FrameLength(&data[i], len - i);
+            CAPTURE_Instruction(text, sizeof(text), &data[i], n);
+            printf("%s %s", (i > 0) ? ";" : "", text);
+          }
+          if (i < len)
+          {
+            printf(" data");
+            CAPTURE_PrintData(&data[i], len - i);
+          }
+          printf("\n");
+        } else
+        if ((len > 0) && (data[0] == UPDI_BREAK) && (data[len - 1] == UPDI_BREAK))
+        {
+          printf("-> BREAK x%u\n", (uint16_t)len);
+        } else
+        {
+          printf("-> data");
+          CAPTURE_PrintData(data, len);
+          printf("\n");
+        }
+        // half duplex line, everything sent comes back first
+        echo_len = (len <= CAPTURE_ECHO_LEN) ? len : 0;
+        memcpy(echo, data, echo_len);
+        break;
+      case CAPTURE_RX:
+        if (len == 0)
+        {
+          printf("<- timeout\n");
+        } else
+        if ((len == echo_len) && (memcmp(data, echo, len) == 0))
+        {
+          printf("<- echo\n");
+          echo_len = 0;
+        } else
+        if ((len == 1) && (data[0] == UPDI_PHY_ACK))
+        {
+          printf("<- ACK\n");
+        } else
+        {
+          printf("<-");
+          CAPTURE_PrintData(data, len);
+          printf("\n");
+        }
+        break;
+      default:
+        printf("unknown record %d\n", record.type);
+        break;
+    }
+    free(record.data);
+  }
+  fclose(fp);
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "libupdi.h"
+
+#define CAPTURE_MAGIC       "UPDICAP"
+#define CAPTURE_VERSION     (1)
+#define CAPTURE_ECHO_LEN    (256)
+
+/**< Trace is the magic with version byte followed by records:
+     type byte, LEB128 time since the previous record in microseconds,
+     LEB128 length and the data bytes */
+enum {
+  CAPTURE_TX,       // bytes written to the port
+  CAPTURE_RX,       // bytes read from the port, empty on timeout
+  CAPTURE_OPEN,     // port opened, 32-bit baudrate and line settings
+  CAPTURE_CLOSE,    // port closed
+  CAPTURE_BREAK     // line held low, 32-bit duration in microseconds
+};
+
+typedef struct
+{
+  uint8_t   type;
+  uint32_t  gap;        // microseconds since the previous record
+  uint16_t  len;
+  uint8_t   *data;
+} tCaptureRecord;
+
+typedef struct
+{
+  FILE      *fp;
+  uint64_t  last;
+} tCapture;
+
+bool CAPTURE_Start(char *filename);
+void CAPTURE_Stop(void);
+void CAPTURE_Record(uint8_t type, uint8_t *data, uint16_t len);
+FILE *CAPTURE_OpenTrace(char *filename);
+bool CAPTURE_ReadRecord(FILE *fp, tCaptureRecord *record);
+
+#endif
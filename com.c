@@ -5,6 +5,8 @@
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 #endif
@@ -13,14 +15,12 @@
 #include <stdbool.h>
 #include <math.h>
 
-#ifdef __MINGW32__
-static HANDLE hSerial;
-#endif
-#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
-static int fd;
-#endif
-
-static uint32_t COM_Baudrate = 115200;
+#include "capture.h"
+#include "instr.h"
+#include "replay.h"
+#include "session.h"
+#include "sleep.h"
+#include "stats.h"
 
 /** \brief Open COM port with settings
  *
@@ -34,19 +34,22 @@ static uint32_t COM_Baudrate = 115200;
 bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits)
 {
   printf("Opening %s at %u baud\n", port, baudrate);
-  COM_Baudrate = baudrate;
+  SESSION_Current->baudrate = baudrate;
+  INSTR_BAUDRATE(baudrate);
+  if (SESSION_Current->replay != NULL)
+    return REPLAY_Open(baudrate);
   #ifdef __MINGW32__
   char str[64];
   uint8_t multiplier;
 
   sprintf(str, "\\\\.\\%s", port);
-  hSerial = CreateFile(str, GENERIC_READ | GENERIC_WRITE, 0,
+  SESSION_Current->hSerial = CreateFile(str, GENERIC_READ | GENERIC_WRITE, 0,
                               NULL, OPEN_EXISTING, 0, NULL);
-  if (hSerial == INVALID_HANDLE_VALUE)
+  if (SESSION_Current->hSerial == INVALID_HANDLE_VALUE)
     return false;
   DCB dcbSerialParams = { 0 }; // Initializing DCB structure
   dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
-  GetCommState(hSerial, &dcbSerialParams);
+  GetCommState(SESSION_Current->hSerial, &dcbSerialParams);
   dcbSerialParams.BaudRate = baudrate;  // Setting BaudRate
   dcbSerialParams.ByteSize = 8;         // Setting ByteSize = 8
   if (two_stopbits == true)
@@ -58,7 +61,7 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
   else
     dcbSerialParams.Parity   = NOPARITY;
   dcbSerialParams.fDtrControl = DTR_CONTROL_DISABLE;
-  SetCommState(hSerial, &dcbSerialParams);
+  SetCommState(SESSION_Current->hSerial, &dcbSerialParams);
   COMMTIMEOUTS timeouts;
   multiplier = (uint8_t)ceil((float)100000 / baudrate);
   timeouts.ReadIntervalTimeout = 20 * multiplier;
@@ -66,16 +69,16 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
   timeouts.ReadTotalTimeoutConstant = 100 * multiplier;
   timeouts.WriteTotalTimeoutMultiplier = 1;
   timeouts.WriteTotalTimeoutConstant = 1;
-  SetCommTimeouts(hSerial, &timeouts);
+  SetCommTimeouts(SESSION_Current->hSerial, &timeouts);
   //COM_Bytes = 0;
   #endif
 
   #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
-  fd = open(port, O_RDWR | O_NOCTTY );
-  if (fd <0)
+  SESSION_Current->fd = open(port, O_RDWR | O_NOCTTY );
+  if (SESSION_Current->fd <0)
     return false;
   struct termios SerialPortSettings;
-  tcgetattr(fd, &SerialPortSettings);	/* Get the current attributes of the Serial port */
+  tcgetattr(SESSION_Current->fd, &SerialPortSettings);	/* Get the current attributes of the Serial port */
   /* Setting the Baud rate */
   switch (baudrate)
   {
@@ -117,9 +120,12 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
   SerialPortSettings.c_cflag |= (CREAD | CLOCAL); /* Enable receiver,Ignore Modem Control lines       */
   SerialPortSettings.c_cc[VMIN]  = 0;            // read doesn't block
   SerialPortSettings.c_cc[VTIME] = 5;            // 0.1 seconds read timeout
-  tcsetattr(fd, TCSANOW, &SerialPortSettings);  /* Set the attributes to the termios structure*/
-  tcflush(fd, TCIFLUSH);
+  tcsetattr(SESSION_Current->fd, TCSANOW, &SerialPortSettings);  /* Set the attributes to the termios structure*/
+  tcflush(SESSION_Current->fd, TCIFLUSH);
   #endif
+  uint8_t settings[] = {baudrate & 0xFF, (baudrate >> 8) & 0xFF, (baudrate >> 16) & 0xFF, (baudrate >> 24) & 0xFF,
+                        have_parity, two_stopbits};
+  CAPTURE_Record(CAPTURE_OPEN, settings, sizeof(settings));
 
   return true;
 }
@@ -133,6 +139,8 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
  */
 int COM_Write(uint8_t *data, uint16_t len)
 {
+  if (SESSION_Current->replay != NULL)
+    return REPLAY_Write(data, len);
   #ifdef __MINGW32__
   DWORD dwBytesWritten = 0;
   //DWORD signal;
@@ -140,12 +148,15 @@ int COM_Write(uint8_t *data, uint16_t len)
   //int res;
   //ov.hEvent = CreateEvent(NULL, true, true, NULL);
 
-  if (!WriteFile(hSerial, data, len, &dwBytesWritten, NULL))
+  CAPTURE_Record(CAPTURE_TX, data, len);
+  INSTR_TIME(start);
+  if (!WriteFile(SESSION_Current->hSerial, data, len, &dwBytesWritten, NULL))
     return -1;
+  INSTR_RECORD(INSTR_COM_WRITE, dwBytesWritten, start);
   //COM_Bytes += dwBytesWritten;
-//  WriteFile(hSerial, data, len, &dwBytesWritten, &ov);
+//  WriteFile(SESSION_Current->hSerial, data, len, &dwBytesWritten, &ov);
 //  signal = WaitForSingleObject(ov.hEvent, INFINITE);
-//  if ((signal == WAIT_OBJECT_0) && (GetOverlappedResult(hSerial, &ov, &dwBytesWritten, true)))
+//  if ((signal == WAIT_OBJECT_0) && (GetOverlappedResult(SESSION_Current->hSerial, &ov, &dwBytesWritten, true)))
 //    res = 0;
 //  else
 //    res = -1;
@@ -153,14 +164,41 @@ int COM_Write(uint8_t *data, uint16_t len)
 //  return res;
   #endif
   #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
-  int iOut = write(fd, data, len);
+  CAPTURE_Record(CAPTURE_TX, data, len);
+  INSTR_TIME(start);
+  int iOut = write(SESSION_Current->fd, data, len);
   if (iOut < 0)
     return -1;
+  INSTR_RECORD(INSTR_COM_WRITE, iOut, start);
   #endif
 
   return 0;
 }
 
+/** \brief Set read timeout, it replaces the timeout of the port settings
+ *         until it is set to 0, e.g. to poll a silent target quickly
+ *
+ * \param [in] timeout_us Timeout of one read in microseconds, 0 for the port default
+ * \return Nothing
+ *
+ */
+void COM_SetTimeout(uint32_t timeout_us)
+{
+  SESSION_Current->read_timeout_us = timeout_us;
+  if (SESSION_Current->replay != NULL)
+    return;
+  #ifdef __MINGW32__
+  COMMTIMEOUTS timeouts;
+
+  GetCommTimeouts(SESSION_Current->hSerial, &timeouts);
+  if (timeout_us > 0)
+    timeouts.ReadTotalTimeoutConstant = (timeout_us + 999) / 1000;
+  else
+    timeouts.ReadTotalTimeoutConstant = 100 * (uint8_t)ceil((float)100000 / SESSION_Current->baudrate);
+  SetCommTimeouts(SESSION_Current->hSerial, &timeouts);
+  #endif
+}
+
 /** \brief Read data from COM port
  *
  * \param [out] data Data buffer to read data in
@@ -170,41 +208,118 @@ int COM_Write(uint8_t *data, uint16_t len)
  */
 int COM_Read(uint8_t *data, uint16_t len)
 {
+  if (SESSION_Current->replay != NULL)
+    return REPLAY_Read(data, len);
   #ifdef __MINGW32__
   //OVERLAPPED ov = { 0 };
   //COMSTAT status;
   //DWORD errors;
   //DWORD mask, btr, temp, signal;
   DWORD dwBytesRead = 0;
-//  ClearCommError(hSerial, &errors, &status);
-//  if (!ReadFile(hSerial, data, len, &dwBytesRead, &ov))
+//  ClearCommError(SESSION_Current->hSerial, &errors, &status);
+//  if (!ReadFile(SESSION_Current->hSerial, data, len, &dwBytesRead, &ov))
 //    return -1;
 
 //  btr = 0;
 //  while (btr < len)
 //  {
-//    SetCommMask(hSerial, EV_RXCHAR);
-//    WaitCommEvent(hSerial, &mask, NULL);
+//    SetCommMask(SESSION_Current->hSerial, EV_RXCHAR);
+//    WaitCommEvent(SESSION_Current->hSerial, &mask, NULL);
 //    if (mask & EV_ERR)
 //      break;
-//    ClearCommError(hSerial, &temp, &status);
+//    ClearCommError(SESSION_Current->hSerial, &temp, &status);
 //    btr = status.cbInQue;
 //    if (btr >= len)
 //    {
-//      ReadFile(hSerial, data, len, &dwBytesRead, NULL);
+//      ReadFile(SESSION_Current->hSerial, data, len, &dwBytesRead, NULL);
 //    }
 //  }
-  ReadFile(hSerial, data, len, &dwBytesRead, NULL);
+  INSTR_TIME(start);
+  ReadFile(SESSION_Current->hSerial, data, len, &dwBytesRead, NULL);
+  INSTR_RECORD(INSTR_COM_READ, dwBytesRead, start);
+  if (dwBytesRead < len)
+    INSTR_TIMEOUT(INSTR_COM_READ);
   #endif
   #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
-  int dwBytesRead = read(fd, data, len);
-  if (dwBytesRead < 0)
-    return -1;
+  int dwBytesRead = 0;
+  int n;
+  struct pollfd pfd = {SESSION_Current->fd, POLLIN, 0};
+  uint64_t deadline = STATS_GetTime() + SESSION_Current->read_timeout_us;
+  uint64_t now;
+  // read() returns as soon as anything arrives, so collect the whole burst
+  while (dwBytesRead < len)
+  {
+    // own timeout is shorter than VTIME, the read is started only with data waiting
+    if (SESSION_Current->read_timeout_us > 0)
+    {
+      now = STATS_GetTime();
+      if ((now >= deadline) || (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) <= 0))
+      {
+        INSTR_TIMEOUT(INSTR_COM_READ);
+        break;
+      }
+    }
+    INSTR_TIME(start);
+    n = read(SESSION_Current->fd, &data[dwBytesRead], len - dwBytesRead);
+    if (n < 0)
+      return -1;
+    INSTR_RECORD(INSTR_COM_READ, n, start);
+    if (n == 0)
+    {
+      INSTR_TIMEOUT(INSTR_COM_READ);
+      break;  // inter-byte timeout
+    }
+    dwBytesRead += n;
+  }
   #endif
+  if (dwBytesRead > 0)
+    CAPTURE_Record(CAPTURE_RX, data, dwBytesRead);
+  if (dwBytesRead < len)
+    CAPTURE_Record(CAPTURE_RX, NULL, 0);
 
   return dwBytesRead;
 }
 
+/** \brief Hold the line low for the given time, without reopening the port
+ *         at a lower baudrate. Input received meanwhile is dropped
+ *
+ * \param [in] duration Break duration in microseconds
+ * \return true if succeed, false if the port can't send a break
+ *
+ */
+bool COM_Break(uint32_t duration)
+{
+  uint8_t data[] = {duration & 0xFF, (duration >> 8) & 0xFF, (duration >> 16) & 0xFF, (duration >> 24) & 0xFF};
+  uint64_t target;
+
+  if (SESSION_Current->replay != NULL)
+    return REPLAY_Break(duration);
+  #ifdef __MINGW32__
+  if (!SetCommBreak(SESSION_Current->hSerial))
+    return false;
+  #endif
+  #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+  if (ioctl(SESSION_Current->fd, TIOCSBRK) < 0)
+    return false;
+  #endif
+  // sleep the most of it, the rest is waited out exactly
+  target = STATS_GetTime() + duration;
+  while (STATS_GetTime() + 1000 < target)
+    msleep(1);
+  while (STATS_GetTime() < target);
+  #ifdef __MINGW32__
+  ClearCommBreak(SESSION_Current->hSerial);
+  PurgeComm(SESSION_Current->hSerial, PURGE_RXCLEAR);
+  #endif
+  #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+  ioctl(SESSION_Current->fd, TIOCCBRK);
+  tcflush(SESSION_Current->fd, TCIFLUSH);
+  #endif
+  CAPTURE_Record(CAPTURE_BREAK, data, sizeof(data));
+
+  return true;
+}
+
 /** \brief Calculate time for transmission with current baudrate
  *
  * \param [in] len Length of transmitted data
@@ -213,7 +328,7 @@ int COM_Read(uint8_t *data, uint16_t len)
  */
 uint16_t COM_GetTransTime(uint16_t len)
 {
-  return (uint16_t)(len * 1000 * 11 / COM_Baudrate + 1);
+  return (uint16_t)(len * 1000 * 11 / SESSION_Current->baudrate + 1);
 }
 
 #ifdef __MINGW32__
@@ -222,7 +337,7 @@ void COM_WaitForTransmit(void)
   COMSTAT rStat;
   DWORD nErr;
   do {
-    ClearCommError(hSerial, &nErr, &rStat);
+    ClearCommError(SESSION_Current->hSerial, &nErr, &rStat);
   } while (rStat.cbOutQue > 0);
 }
 #endif // __MINGW32__
@@ -235,10 +350,16 @@ void COM_WaitForTransmit(void)
 void COM_Close(void)
 {
   printf("Closing COM port\n");
+  if (SESSION_Current->replay != NULL)
+  {
+    REPLAY_Close();
+    return;
+  }
+  CAPTURE_Record(CAPTURE_CLOSE, NULL, 0);
   #ifdef __MINGW32__
-  CloseHandle(hSerial);
+  CloseHandle(SESSION_Current->hSerial);
   #endif
   #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
-  close(fd);
+  close(SESSION_Current->fd);
   #endif
 }
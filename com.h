@@ -6,7 +6,9 @@
 
 bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits);
 int COM_Write(uint8_t *data, uint16_t len);
+void COM_SetTimeout(uint32_t timeout_us);
 int COM_Read(uint8_t *data, uint16_t len);
+bool COM_Break(uint32_t duration);
 uint16_t COM_GetTransTime(uint16_t len);
 void COM_WaitForTransmit(void);
 void COM_Close(void);
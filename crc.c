@@ -0,0 +1,29 @@
+#include "crc.h"
+
+/** \brief Calculate CRC16-CCITT the same way the CRCSCAN peripheral does
+ *         (MSB first, no final XOR)
+ *
+ * \param [in] crc Initial CRC value
+ * \param [in] data Data buffer
+ * \param [in] len Length of data
+ * \return CRC value as uint16_t
+ *
+ */
+uint16_t CRC_Ccitt16(uint16_t crc, uint8_t *data, uint16_t len)
+{
+  uint8_t i;
+
+  while (len-- > 0)
+  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (i = 0; i < 8; i++)
+    {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ CRC_CCITT16_POLY;
+      else
+        crc <<= 1;
+    }
+  }
+
+  return crc;
+}
@@ -0,0 +1,11 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+
+#define CRC_CCITT16_POLY    (0x1021)
+#define CRC_CCITT16_INIT    (0xFFFF)
+
+uint16_t CRC_Ccitt16(uint16_t crc, uint8_t *data, uint16_t len);
+
+#endif
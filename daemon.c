@@ -0,0 +1,421 @@
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "daemon.h"
+#include "devices.h"
+#include "libupdi.h"
+#include "log.h"
+#include "session.h"
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+typedef struct
+{
+  char    name[DAEMON_NAME_LEN];
+  char    *text;
+  size_t  len;
+} tDaemonData;
+
+typedef struct
+{
+  char      port[DAEMON_PORT_LEN];
+  char      device[DAEMON_NAME_LEN];
+  uint32_t  baudrate;
+  bool      error;
+  bool      stats;
+  tPlan     plan;
+} tDaemonJob;
+
+static tDaemonData DAEMON_Data[DAEMON_MAX_DATA];
+static tSession *DAEMON_Session = NULL;     // port kept open between jobs
+static char DAEMON_Port[DAEMON_PORT_LEN];
+static uint32_t DAEMON_Baudrate;
+static bool DAEMON_Shutdown = false;
+
+/** \brief Open image source, "@NAME" refers to inline data sent by the client
+ *
+ * \param [in] name File name or inline data name
+ * \return stream handle, NULL on error
+ *
+ */
+static FILE *DAEMON_Open(char *name)
+{
+  uint8_t i;
+
+  if (name[0] != '@')
+    return fopen(name, "rb");
+  for (i = 0; i < DAEMON_MAX_DATA; i++)
+  {
+    if ((DAEMON_Data[i].len > 0) && (strcmp(DAEMON_Data[i].name, &name[1]) == 0))
+      return fmemopen(DAEMON_Data[i].text, DAEMON_Data[i].len, "r");
+  }
+  return NULL;
+}
+
+/** \brief Receive inline image text up to the line "end"
+ *
+ * \param [in] in Client stream
+ * \param [in] name Name of the inline data
+ * \return true if succeed
+ *
+ */
+static bool DAEMON_ReadData(FILE *in, char *name)
+{
+  tDaemonData *data = NULL;
+  char line[DAEMON_LINE_LEN];
+  char *tmp;
+  size_t len;
+  uint8_t i;
+
+  if ((strlen(name) == 0) || (strlen(name) >= DAEMON_NAME_LEN))
+    return false;
+  for (i = 0; i < DAEMON_MAX_DATA; i++)
+  {
+    // same name replaces the old content
+    if ((DAEMON_Data[i].len > 0) && (strcmp(DAEMON_Data[i].name, name) == 0))
+    {
+      data = &DAEMON_Data[i];
+      break;
+    }
+    if ((data == NULL) && (DAEMON_Data[i].len == 0))
+      data = &DAEMON_Data[i];
+  }
+  if (data == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "No room for inline data, maximum is %d", DAEMON_MAX_DATA);
+    return false;
+  }
+  strcpy(data->name, name);
+  data->len = 0;
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    if (strncmp(line, "end", 3) == 0)
+      return (data->len > 0);
+    len = strlen(line);
+    if ((tmp = realloc(data->text, data->len + len)) == NULL)
+    {
+      free(data->text);
+      data->text = NULL;
+      data->len = 0;
+      return false;
+    }
+    data->text = tmp;
+    memcpy(&data->text[data->len], line, len);
+    data->len += len;
+  }
+  data->len = 0;
+  return false;
+}
+
+/** \brief Close the kept session, NVM timing it learned goes back to the
+ *         default session, so the next session and the saved profile have it
+ *
+ * \return Nothing
+ *
+ */
+static void DAEMON_CloseSession(void)
+{
+  tTiming timing;
+
+  if (DAEMON_Session == NULL)
+    return;
+  SESSION_Select(DAEMON_Session);
+  timing = SESSION_Current->timing;
+  SESSION_Close(DAEMON_Session);
+  DAEMON_Session = NULL;
+  timing.pending = TIMING_NONE;
+  SESSION_Current->timing = timing;
+}
+
+/** \brief Bring up UPDI link, the port stays open while it does not change
+ *
+ * \param [in] job Job with port settings
+ * \return true if succeed
+ *
+ */
+static bool DAEMON_Connect(tDaemonJob *job)
+{
+  if ((DAEMON_Session != NULL) && (strcmp(DAEMON_Port, job->port) == 0) && (DAEMON_Baudrate == job->baudrate))
+  {
+    // the job may target another device type on the same port
+    SESSION_SetDevice(DAEMON_Session, job->device);
+    return SESSION_Connect(DAEMON_Session);
+  }
+
+  DAEMON_CloseSession();
+  DAEMON_Session = SESSION_Open(job->port, job->baudrate, job->device, true);
+  if (DAEMON_Session == NULL)
+    return false;
+  strcpy(DAEMON_Port, job->port);
+  DAEMON_Baudrate = job->baudrate;
+
+  return true;
+}
+
+/** \brief Execute job and report the result to the client
+ *
+ * \param [in] job Job to execute
+ * \return Nothing
+ *
+ */
+static void DAEMON_RunJob(tDaemonJob *job)
+{
+  bool res = false;
+
+  if (job->error == true)
+  {
+    printf("Job has errors, skipped\n");
+  } else
+  if (strlen(job->port) == 0)
+  {
+    printf("COM port name is missing!\n");
+  } else
+  if ((DEVICES_GetId(job->device) < 0) && (strcmp(job->device, DEVICES_AUTO) != 0))
+  {
+    printf("Device type is not set!\n");
+  } else
+  if (job->plan.number == 0)
+  {
+    printf("Nothing to do\n");
+  } else
+  {
+    // kept session starts its statistics with the resync, a new one when opened
+    if (DAEMON_Session != NULL)
+      SESSION_ResetStats(DAEMON_Session);
+    if (DAEMON_Connect(job) == false)
+    {
+      printf("Can't connect to device on %s\n", job->port);
+    } else
+    {
+      printf("Working with device: %s\n", job->device);
+      PLAN_Optimize(&job->plan);
+      res = SESSION_Execute(DAEMON_Session, &job->plan);
+      if (job->stats == true)
+        SESSION_PrintStats(DAEMON_Session, stdout, res);
+    }
+  }
+  printf("RESULT %s\n", (res == true) ? "PASS" : "FAIL");
+  fflush(stdout);
+}
+
+/** \brief Reset job to an empty plan, connection settings stay
+ *
+ * \param [out] job Job to reset
+ * \return Nothing
+ *
+ */
+static void DAEMON_ResetJob(tDaemonJob *job)
+{
+  job->error = false;
+  job->stats = false;
+  PLAN_Init(&job->plan);
+  job->plan.open = DAEMON_Open;
+}
+
+/** \brief Serve one client connection, all output goes to the client
+ *
+ * Commands: "port NAME", "baud N", "device NAME", "offset N",
+ * "option verify|verify-crc|auto-erase|app-only|stats", "data NAME" followed by image text
+ * up to "end", any plan line, "run" and "shutdown". Images are referenced by
+ * file name or as "@NAME" for inline data.
+ *
+ * \param [in] client Client socket
+ * \param [in] defaults Job with default settings
+ * \return Nothing
+ *
+ */
+static void DAEMON_Serve(int client, tDaemonJob *defaults)
+{
+  tDaemonJob connection = *defaults;
+  tDaemonJob *job = &connection;
+  FILE *in;
+  char line[DAEMON_LINE_LEN];
+  char cmd[DAEMON_NAME_LEN];
+  char arg[DAEMON_LINE_LEN];
+  int saved;
+
+  if ((in = fdopen(client, "r")) == NULL)
+  {
+    close(client);
+    return;
+  }
+  fflush(stdout);
+  saved = dup(STDOUT_FILENO);
+  dup2(client, STDOUT_FILENO);
+
+  DAEMON_ResetJob(job);
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    arg[0] = 0;
+    if (sscanf(line, "%31s %255[^\r\n]", cmd, arg) < 1)
+      continue;
+    if (strcmp(cmd, "port") == 0)
+    {
+      strncpy(job->port, arg, DAEMON_PORT_LEN);
+      job->port[DAEMON_PORT_LEN - 1] = 0;
+    } else
+    if (strcmp(cmd, "baud") == 0)
+    {
+      job->baudrate = (uint32_t)strtoul(arg, NULL, 10);
+    } else
+    if (strcmp(cmd, "device") == 0)
+    {
+      strncpy(job->device, arg, DAEMON_NAME_LEN);
+      job->device[DAEMON_NAME_LEN - 1] = 0;
+    } else
+    if (strcmp(cmd, "offset") == 0)
+    {
+      job->plan.offset = (uint16_t)strtoul(arg, NULL, 0);
+    } else
+    if (strcmp(cmd, "option") == 0)
+    {
+      if (strcmp(arg, "verify") == 0)
+        job->plan.verify = true;
+      else
+      if (strcmp(arg, "verify-crc") == 0)
+        job->plan.verify_crc = true;
+      else
+      if (strcmp(arg, "auto-erase") == 0)
+        job->plan.auto_erase = true;
+      else
+      if (strcmp(arg, "app-only") == 0)
+        job->plan.app_only = true;
+      else
+      if (strcmp(arg, "stats") == 0)
+        job->stats = true;
+      else
+      {
+        printf("Unknown option: %s\n", arg);
+        job->error = true;
+      }
+    } else
+    if (strcmp(cmd, "data") == 0)
+    {
+      if (DAEMON_ReadData(in, arg) == false)
+      {
+        printf("Wrong inline data: %s\n", arg);
+        job->error = true;
+      }
+    } else
+    if (strcmp(cmd, "run") == 0)
+    {
+      DAEMON_RunJob(job);
+      DAEMON_ResetJob(job);
+    } else
+    if (strcmp(cmd, "shutdown") == 0)
+    {
+      DAEMON_Shutdown = true;
+      break;
+    } else
+    if (PLAN_AddLine(&job->plan, line) == false)
+    {
+      job->error = true;
+    }
+    fflush(stdout);
+  }
+  // job without "run" is executed when the client stops sending
+  if ((job->plan.number > 0) || (job->error == true))
+    DAEMON_RunJob(job);
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  fclose(in);
+}
+#endif
+
+/** \brief Run programming daemon, jobs are received on a Unix domain socket
+ *
+ * Port stays open and parsed images stay cached between jobs, so a job
+ * pays only for the UPDI resync and the programming itself.
+ *
+ * \param [in] path Socket path
+ * \param [in] port Default COM port
+ * \param [in] baudrate Default baudrate
+ * \param [in] device Default device id, -1 if not set
+ * \return true if succeed
+ *
+ */
+bool DAEMON_Run(char *path, char *port, uint32_t baudrate, int8_t device)
+{
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+  struct sockaddr_un addr;
+  tDaemonJob job;
+  mode_t mask;
+  int srv;
+  int client;
+  uint8_t i;
+
+  memset(&addr, 0, sizeof(addr));
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Socket path is too long: %s", path);
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if ((srv = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create socket");
+    return false;
+  }
+  unlink(path);
+  // jobs can read and write files as the daemon user, only this user may connect
+  mask = umask(S_IRWXG | S_IRWXO);
+  if (bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    umask(mask);
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to listen on %s", path);
+    close(srv);
+    return false;
+  }
+  umask(mask);
+  if ((chmod(path, DAEMON_SOCKET_MODE) < 0) || (listen(srv, 4) < 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to listen on %s", path);
+    close(srv);
+    return false;
+  }
+  // clients going away must not kill the daemon
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&job, 0, sizeof(job));
+  strncpy(job.port, port, DAEMON_PORT_LEN);
+  job.port[DAEMON_PORT_LEN - 1] = 0;
+  job.baudrate = baudrate;
+  if (device == DEVICE_AUTO_ID)
+    strcpy(job.device, DEVICES_AUTO);
+  else
+  if (device >= 0)
+    strcpy(job.device, DEVICES_GetNameByNumber(device));
+
+  printf("Waiting for jobs on %s\n", path);
+  while (DAEMON_Shutdown == false)
+  {
+    if ((client = accept(srv, NULL, NULL)) < 0)
+      continue;
+    LOG_Print(LOG_LEVEL_INFO, "Client connected");
+    DAEMON_Serve(client, &job);
+    LOG_Print(LOG_LEVEL_INFO, "Client disconnected");
+  }
+
+  close(srv);
+  unlink(path);
+  DAEMON_CloseSession();
+  IMAGE_FreeCache();
+  for (i = 0; i < DAEMON_MAX_DATA; i++)
+    free(DAEMON_Data[i].text);
+
+  return true;
+#else
+  LOG_Print(LOG_LEVEL_ERROR, "Daemon mode is not supported on this platform");
+  return false;
+#endif
+}
@@ -0,0 +1,16 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DAEMON_PATH_LEN     (108)
+#define DAEMON_PORT_LEN     (32)
+#define DAEMON_NAME_LEN     (32)
+#define DAEMON_MAX_DATA     (8)
+#define DAEMON_LINE_LEN     (256)
+#define DAEMON_SOCKET_MODE  (0600)    // owner only, jobs run with the rights of the daemon
+
+bool DAEMON_Run(char *path, char *port, uint32_t baudrate, int8_t device);
+
+#endif
@@ -1,7 +1,12 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "devices.h"
+#include "log.h"
+#include "session.h"
 
-tDevice DEVICES_List[] =
+static tDevice DEVICES_Builtin[] =
 {
   {
     "mega480x",
@@ -13,7 +18,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    64,
+    64,
+    {0x9650, 0x9651},
+    0,
+    2,
+    4
   },
   {
     "mega320x",
@@ -25,7 +39,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    64,
+    64,
+    {0x9530, 0x9531},
+    0,
+    2,
+    4
   },
   {
     "mega160x",
@@ -37,7 +60,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    64,
+    64,
+    {0x9426, 0x9427},
+    0,
+    2,
+    4
   },
   {
     "mega80x",
@@ -49,7 +81,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    64,
+    64,
+    {0x9326, 0x932A},
+    0,
+    2,
+    4
   },
   {
     "AVR32DAxx",
@@ -61,7 +102,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1050,
     0x1080,
-    9
+    9,
+    0x0000,
+    0x1400,
+    512,
+    32,
+    32,
+    {0x9534, 0x9533, 0x9532},
+    2,
+    0,
+    0
   },
   {
     "AVR32DBxx",
@@ -73,7 +123,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1050,
     0x1080,
-    9
+    9,
+    0x0000,
+    0x1400,
+    512,
+    32,
+    32,
+    {0x9537, 0x9536, 0x9535},
+    2,
+    0,
+    0
   },
   {
     "AVR16DDxx",
@@ -85,7 +144,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1050,
     0x1080,
-    9
+    9,
+    0x0000,
+    0x1400,
+    256,
+    32,
+    32,
+    {0x9434, 0x9433, 0x9432, 0x9431},
+    2,
+    0,
+    0
   },
   {
     "AVR32DDxx",
@@ -97,7 +165,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1050,
     0x1080,
-    9
+    9,
+    0x0000,
+    0x1400,
+    256,
+    32,
+    32,
+    {0x953B, 0x953A, 0x9539, 0x9538},
+    2,
+    0,
+    0
   },
   {
     "tiny321x",
@@ -109,7 +186,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    64,
+    64,
+    {0x9521, 0x9522},
+    0,
+    2,
+    4
   },
   {
     "tiny160x",
@@ -121,7 +207,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    32,
+    32,
+    {0x9425, 0x9424, 0x9423},
+    0,
+    2,
+    4
   },
   {
     "tiny161x",
@@ -133,7 +228,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    32,
+    32,
+    {0x9422, 0x9421, 0x9420},
+    0,
+    2,
+    4
   },
   {
     "tiny162x",
@@ -145,7 +249,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    256,
+    32,
+    32,
+    {0x942A, 0x9429, 0x9428},
+    0,
+    2,
+    4
   },
   {
     "tiny80x",
@@ -157,7 +270,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x9325, 0x9324, 0x9323},
+    0,
+    2,
+    4
   },
   {
     "tiny81x",
@@ -169,7 +291,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x9322, 0x9321, 0x9320},
+    0,
+    2,
+    4
   },
   {
     "tiny82x",
@@ -181,7 +312,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x9329, 0x9328, 0x9327},
+    0,
+    2,
+    4
   },
   {
     "tiny40x",
@@ -193,7 +333,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x9227, 0x9226, 0x9225},
+    0,
+    2,
+    4
   },
   {
     "tiny41x",
@@ -205,7 +354,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x9223, 0x9222, 0x9221, 0x9220},
+    0,
+    2,
+    4
   },
   {
     "tiny42x",
@@ -217,7 +375,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    128,
+    32,
+    32,
+    {0x922C, 0x922B, 0x922A},
+    0,
+    2,
+    4
   },
   {
     "tiny20x",
@@ -229,7 +396,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    64,
+    32,
+    32,
+    {0x9123, 0x9122},
+    0,
+    2,
+    4
   },
   {
     "tiny21x",
@@ -241,7 +417,16 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    64,
+    32,
+    32,
+    {0x9121, 0x9120},
+    0,
+    2,
+    4
   },
   {
     "tiny22x",
@@ -253,35 +438,451 @@ tDevice DEVICES_List[] =
     0x1100,
     0x1280,
     0x1300,
-    9
+    9,
+    0x0120,
+    0x1400,
+    64,
+    32,
+    32,
+    {0},
+    0,
+    2,
+    4
   }
 };
 
-static int8_t DEVICE_Id = DEVICE_UNKNOWN_ID;
+tDevice *DEVICES_List = DEVICES_Builtin;
+static uint8_t DEVICES_Count = sizeof(DEVICES_Builtin) / sizeof(tDevice);
 
-/** \brief Get device ID from name string
+/**< open addressing tables from signature and from name to device ID, built once for the
+     built-in list and again by DEVICES_Load, lookups only read them */
+static struct
+{
+  uint16_t signature;
+  int8_t   id;
+} DEVICES_Index[DEVICES_INDEX_SIZE];
+static struct
+{
+  uint32_t hash;
+  int8_t   id;      // DEVICE_UNKNOWN_ID if slot is free
+} DEVICES_NameIndex[DEVICES_INDEX_SIZE];
+static pthread_once_t DEVICES_IndexOnce = PTHREAD_ONCE_INIT;
+
+/** \brief Get slot of the signature in the index
  *
- * \param [in] name Name to find as string
- * \return index of the found device or -1 as error
+ * \param [in] signature 2nd and 3rd signature bytes
+ * \return slot of the signature or of the free place for it
  *
  */
-int8_t DEVICES_GetId(char *name)
+static uint16_t DEVICES_FindSlot(uint16_t signature)
+{
+  uint16_t slot = (uint16_t)((signature * 40503u) >> 7) & (DEVICES_INDEX_SIZE - 1);
+
+  while ((DEVICES_Index[slot].signature != 0) && (DEVICES_Index[slot].signature != signature))
+    slot = (slot + 1) & (DEVICES_INDEX_SIZE - 1);
+  return slot;
+}
+
+/** \brief Calculate FNV-1a hash of the name
+ *
+ * \param [in] name Name as string
+ * \return hash as uint32_t
+ *
+ */
+static uint32_t DEVICES_Hash(char *name)
+{
+  uint32_t hash = 2166136261u;
+
+  while (*name != 0)
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  return hash;
+}
+
+/** \brief Get slot of the name in the index
+ *
+ * \param [in] name Name as string
+ * \param [in] hash Hash of the name
+ * \return slot of the name or of the free place for it
+ *
+ */
+static uint16_t DEVICES_FindNameSlot(char *name, uint32_t hash)
+{
+  uint16_t slot = (uint16_t)hash & (DEVICES_INDEX_SIZE - 1);
+
+  while ((DEVICES_NameIndex[slot].id != DEVICE_UNKNOWN_ID) &&
+         ((DEVICES_NameIndex[slot].hash != hash) || (strcmp(DEVICES_List[DEVICES_NameIndex[slot].id].name, name) != 0)))
+    slot = (slot + 1) & (DEVICES_INDEX_SIZE - 1);
+  return slot;
+}
+
+/** \brief Build name and signature indexes of the device list, devices
+ *         loaded later take over the names and signatures of the earlier ones
+ *
+ * \return Nothing
+ *
+ */
+static void DEVICES_BuildIndex(void)
+{
+  uint32_t hash;
+  uint16_t i, slot;
+  uint8_t j;
+
+  memset(DEVICES_Index, 0, sizeof(DEVICES_Index));
+  for (i = 0; i < DEVICES_INDEX_SIZE; i++)
+    DEVICES_NameIndex[i].id = DEVICE_UNKNOWN_ID;
+  for (i = 0; i < DEVICES_Count; i++)
+  {
+    hash = DEVICES_Hash(DEVICES_List[i].name);
+    slot = DEVICES_FindNameSlot(DEVICES_List[i].name, hash);
+    DEVICES_NameIndex[slot].hash = hash;
+    DEVICES_NameIndex[slot].id = i;
+    for (j = 0; (j < DEVICES_MAX_SIGNATURES) && (DEVICES_List[i].signatures[j] != 0); j++)
+    {
+      slot = DEVICES_FindSlot(DEVICES_List[i].signatures[j]);
+      DEVICES_Index[slot].signature = DEVICES_List[i].signatures[j];
+      DEVICES_Index[slot].id = i;
+    }
+  }
+}
+
+/** \brief Parse numbers separated by ':'
+ *
+ * \param [in] value Text to parse
+ * \param [out] numbers Parsed numbers
+ * \param [in] count Number of numbers expected
+ * \return true if succeed
+ *
+ */
+static bool DEVICES_ParseNumbers(char *value, uint16_t *numbers, uint8_t count)
+{
+  unsigned long number;
+  char *end;
+  uint8_t i;
+
+  for (i = 0; i < count; i++)
+  {
+    number = strtoul(value, &end, 0);
+    if ((end == value) || (number > 0xFFFF) || (*end != ((i < count - 1) ? ':' : 0)))
+      return false;
+    numbers[i] = (uint16_t)number;
+    value = end + 1;
+  }
+  return true;
+}
+
+/** \brief Parse "name=value" field of a device line
+ *
+ * \param [out] device Device to fill
+ * \param [in] field Field text
+ * \return true if succeed
+ *
+ */
+static bool DEVICES_ParseField(tDevice *device, char *field)
 {
+  uint16_t numbers[3];
+  unsigned long signature;
+  char *value;
+  char *end;
   uint8_t i;
 
-  for (i = 0; i < sizeof(DEVICES_List) / sizeof(tDevice); i++)
+  if ((value = strchr(field, '=')) == NULL)
+    return false;
+  *value++ = 0;
+  if (strcmp(field, "flash") == 0)
+  {
+    if (DEVICES_ParseNumbers(value, numbers, 3) == false)
+      return false;
+    device->flash_start = numbers[0];
+    device->flash_size = numbers[1];
+    device->flash_pagesize = numbers[2];
+  } else
+  if (strcmp(field, "eeprom") == 0)
+  {
+    if (DEVICES_ParseNumbers(value, numbers, 3) == false)
+      return false;
+    device->eeprom_start = numbers[0];
+    device->eeprom_size = numbers[1];
+    device->eeprom_pagesize = numbers[2];
+  } else
+  if (strcmp(field, "userrow") == 0)
+  {
+    if (DEVICES_ParseNumbers(value, numbers, 2) == false)
+      return false;
+    device->userrow_address = numbers[0];
+    device->userrow_size = numbers[1];
+  } else
+  if (strcmp(field, "fuses") == 0)
+  {
+    if ((DEVICES_ParseNumbers(value, numbers, 2) == false) || (numbers[1] > 0xFF))
+      return false;
+    device->fuses_address = numbers[0];
+    device->number_of_fuses = (uint8_t)numbers[1];
+  } else
+  if (strcmp(field, "syscfg") == 0)
+    return DEVICES_ParseNumbers(value, &device->syscfg_address, 1);
+  else
+  if (strcmp(field, "nvmctrl") == 0)
+    return DEVICES_ParseNumbers(value, &device->nvmctrl_address, 1);
+  else
+  if (strcmp(field, "sigrow") == 0)
+    return DEVICES_ParseNumbers(value, &device->sigrow_address, 1);
+  else
+  if (strcmp(field, "crcscan") == 0)
+    return DEVICES_ParseNumbers(value, &device->crcscan_address, 1);
+  else
+  if (strcmp(field, "page_write_ms") == 0)
+    return DEVICES_ParseNumbers(value, &device->page_write_ms, 1);
+  else
+  if (strcmp(field, "chip_erase_ms") == 0)
+    return DEVICES_ParseNumbers(value, &device->chip_erase_ms, 1);
+  else
+  if (strcmp(field, "nvm") == 0)
+  {
+    if ((DEVICES_ParseNumbers(value, numbers, 1) == false) || (numbers[0] > 9))
+      return false;
+    device->nvm_version = (uint8_t)numbers[0];
+  } else
+  if (strcmp(field, "signature") == 0)
   {
-    if (strcmp(name, DEVICES_List[i].name) == 0)
+    // up to DEVICES_MAX_SIGNATURES as hex bytes, e.g. 1E9320,1E9321
+    for (i = 0; i < DEVICES_MAX_SIGNATURES; i++)
     {
-      DEVICE_Id = i;
+      signature = strtoul(value, &end, 16);
+      if ((end == value) || ((signature >> 16) != DEVICES_VENDOR_ID) || ((signature & 0xFFFF) == 0))
+        return false;
+      device->signatures[i] = (uint16_t)signature;
+      if (*end == 0)
+        return true;
+      if (*end != ',')
+        return false;
+      value = end + 1;
+    }
+    return false;
+  } else
+  {
+    return false;
+  }
+  return true;
+}
+
+/** \brief Parse device line "device NAME field=value ..."
+ *
+ * \param [out] device Device to fill
+ * \param [in] line Line text
+ * \return true if succeed
+ *
+ */
+static bool DEVICES_ParseLine(tDevice *device, char *line)
+{
+  char *token;
+
+  memset(device, 0, sizeof(tDevice));
+  if (((token = strtok(line, " \t\r\n")) == NULL) || (strcmp(token, "device") != 0))
+    return false;
+  if (((token = strtok(NULL, " \t\r\n")) == NULL) || (strlen(token) >= DEVICES_NAME_LEN) ||
+      (strcmp(token, DEVICES_AUTO) == 0))
+    return false;
+  strcpy(device->name, token);
+  while ((token = strtok(NULL, " \t\r\n")) != NULL)
+  {
+    if (DEVICES_ParseField(device, token) == false)
+      return false;
+  }
+  // the rest is optional, 0 means the memory or module is not there
+  return (device->flash_size > 0) && (device->flash_pagesize > 0) && (device->nvmctrl_address != 0) &&
+         (device->sigrow_address != 0) && (device->fuses_address != 0);
+}
+
+/** \brief Find device the new definition replaces
+ *
+ * \param [in] list Device list
+ * \param [in] count Number of devices in the list
+ * \param [in] device New device definition
+ * \return index of the device with the same name or a common signature, count if none
+ *
+ */
+static uint16_t DEVICES_FindReplaced(tDevice *list, uint16_t count, tDevice *device)
+{
+  uint16_t i;
+  uint8_t j, k;
+
+  for (i = 0; i < count; i++)
+  {
+    if (strcmp(list[i].name, device->name) == 0)
       return i;
+  }
+  for (i = 0; i < count; i++)
+  {
+    for (j = 0; (j < DEVICES_MAX_SIGNATURES) && (list[i].signatures[j] != 0); j++)
+    {
+      for (k = 0; (k < DEVICES_MAX_SIGNATURES) && (device->signatures[k] != 0); k++)
+      {
+        if (list[i].signatures[j] == device->signatures[k])
+          return i;
+      }
     }
   }
+  return count;
+}
+
+/** \brief Load device definitions from a file, they are added to the built-in
+ *         ones and replace those with the same name or signature. Must be
+ *         called before sessions are opened, the lookups don't lock the list
+ *
+ * \param [in] filename File name
+ * \return true if succeed
+ *
+ */
+bool DEVICES_Load(char *filename)
+{
+  FILE *fp;
+  tDevice *list;
+  tDevice device;
+  char line[DEVICES_LINE_LEN];
+  char *text;
+  uint16_t number = 0;
+  uint16_t loaded = 0;
+  uint16_t count;
+  uint16_t i;
+  bool res = true;
 
-  DEVICE_Id = DEVICE_UNKNOWN_ID;
+  if ((fp = fopen(filename, "r")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  list = malloc(DEVICES_MAX * sizeof(tDevice));
+  if (list == NULL)
+  {
+    fclose(fp);
+    return false;
+  }
+  memcpy(list, DEVICES_List, DEVICES_Count * sizeof(tDevice));
+  count = DEVICES_Count;
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    number++;
+    text = line + strspn(line, " \t");
+    if ((*text == '#') || (*text == '\r') || (*text == '\n') || (*text == 0))
+      continue;
+    if (DEVICES_ParseLine(&device, text) == false)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "%s: error in line %d", filename, number);
+      res = false;
+      break;
+    }
+    // replaced device keeps its place, numbers of the others don't change
+    i = DEVICES_FindReplaced(list, count, &device);
+    if (i == count)
+    {
+      if (count >= DEVICES_MAX)
+      {
+        LOG_Print(LOG_LEVEL_ERROR, "%s: too many devices, maximum is %d", filename, DEVICES_MAX);
+        res = false;
+        break;
+      }
+      count++;
+    }
+    list[i] = device;
+    loaded++;
+  }
+  fclose(fp);
+  if (res == false)
+  {
+    free(list);
+    return false;
+  }
+  LOG_Print(LOG_LEVEL_INFO, "%d devices loaded from %s", loaded, filename);
+  if (DEVICES_List != DEVICES_Builtin)
+    free(DEVICES_List);
+  DEVICES_List = list;
+  DEVICES_Count = (uint8_t)count;
+  // the built-in index is never needed any more, lookups must not rebuild it later
+  pthread_once(&DEVICES_IndexOnce, DEVICES_BuildIndex);
+  DEVICES_BuildIndex();
+  return true;
+}
+
+/** \brief Get device ID from signature bytes
+ *
+ * \param [in] signature Signature bytes as read from the signature row
+ * \return index of the found device or -1 as error
+ *
+ */
+int8_t DEVICES_GetIdBySignature(uint8_t *signature)
+{
+  uint16_t key = (signature[1] << 8) | signature[2];
+  uint16_t slot;
+
+  if ((signature[0] != DEVICES_VENDOR_ID) || (key == 0))
+    return DEVICE_UNKNOWN_ID;
+  pthread_once(&DEVICES_IndexOnce, DEVICES_BuildIndex);
+  slot = DEVICES_FindSlot(key);
+  if (DEVICES_Index[slot].signature == 0)
+    return DEVICE_UNKNOWN_ID;
+  return DEVICES_Index[slot].id;
+}
+
+/** \brief Select device by ID
+ *
+ * \param [in] id Device ID
+ * \return true if ID is valid
+ *
+ */
+bool DEVICES_SetId(int8_t id)
+{
+  if ((id < 0) || (id >= DEVICES_Count))
+    return false;
+  SESSION_Current->device_id = id;
+  return true;
+}
+
+/** \brief Get device ID from name string
+ *
+ * \param [in] name Name to find as string
+ * \return index of the found device, DEVICE_AUTO_ID for "auto" or -1 as error
+ *
+ */
+int8_t DEVICES_GetId(char *name)
+{
+  int8_t id = DEVICES_GetNumberByName(name);
+
+  SESSION_Current->device_id = (id >= 0) ? id : DEVICE_UNKNOWN_ID;
+  return id;
+}
+
+/** \brief Get device number from name string, the selected device is not changed
+ *
+ * \param [in] name Name to find as string
+ * \return number of the found device, DEVICE_AUTO_ID for "auto" or -1 as error
+ *
+ */
+int8_t DEVICES_GetNumberByName(char *name)
+{
+  uint16_t slot;
+
+  pthread_once(&DEVICES_IndexOnce, DEVICES_BuildIndex);
+  slot = DEVICES_FindNameSlot(name, DEVICES_Hash(name));
+  if (DEVICES_NameIndex[slot].id != DEVICE_UNKNOWN_ID)
+    return DEVICES_NameIndex[slot].id;
+
+  if (strcmp(name, DEVICES_AUTO) == 0)
+    return DEVICE_AUTO_ID;
   return -1;
 }
 
+/** \brief Get name of the selected device
+ *
+ * \return Device name as string, empty if not selected
+ *
+ */
+char *DEVICES_GetName(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return "";
+  return DEVICES_List[SESSION_Current->device_id].name;
+}
+
 /** \brief Get flash memory length for selected device
  *
  * \return Size of the flash memory as uint16_t
@@ -289,10 +890,10 @@ int8_t DEVICES_GetId(char *name)
  */
 uint16_t DEVICES_GetFlashLength(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].flash_size;
+    return DEVICES_List[SESSION_Current->device_id].flash_size;
 }
 
 /** \brief Get flash start address for selected device
@@ -302,10 +903,10 @@ uint16_t DEVICES_GetFlashLength(void)
  */
 uint16_t DEVICES_GetFlashStart(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].flash_start;
+    return DEVICES_List[SESSION_Current->device_id].flash_start;
 }
 
 /** \brief Get flash page size for selected device
@@ -315,10 +916,10 @@ uint16_t DEVICES_GetFlashStart(void)
  */
 uint16_t DEVICES_GetPageSize(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].flash_pagesize;
+    return DEVICES_List[SESSION_Current->device_id].flash_pagesize;
 }
 
 /** \brief Get NVM control registers address for selected device
@@ -328,10 +929,10 @@ uint16_t DEVICES_GetPageSize(void)
  */
 uint16_t DEVICES_GetNvmctrlAddress(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].nvmctrl_address;
+    return DEVICES_List[SESSION_Current->device_id].nvmctrl_address;
 }
 
 /** \brief Get fuses address for selected device
@@ -341,10 +942,23 @@ uint16_t DEVICES_GetNvmctrlAddress(void)
  */
 uint16_t DEVICES_GetFusesAddress(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].fuses_address;
+}
+
+/** \brief Get signature row address for selected device
+ *
+ * \return Signature row address as uint16_t
+ *
+ */
+uint16_t DEVICES_GetSigrowAddress(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].fuses_address;
+    return DEVICES_List[SESSION_Current->device_id].sigrow_address;
 }
 
 /** \brief Get number of the fuses for selected device
@@ -354,10 +968,148 @@ uint16_t DEVICES_GetFusesAddress(void)
  */
 uint8_t DEVICES_GetFusesNumber(void)
 {
-  if (DEVICE_Id == DEVICE_UNKNOWN_ID)
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].number_of_fuses;
+}
+
+/** \brief Get CRCSCAN peripheral address for selected device
+ *
+ * \return CRCSCAN address as uint16_t, 0 if not usable
+ *
+ */
+uint16_t DEVICES_GetCrcscanAddress(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].crcscan_address;
+}
+
+/** \brief Get EEPROM start address for selected device
+ *
+ * \return Address of the EEPROM area as uint16_t
+ *
+ */
+uint16_t DEVICES_GetEepromStart(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].eeprom_start;
+}
+
+/** \brief Get EEPROM length for selected device
+ *
+ * \return Size of the EEPROM as uint16_t
+ *
+ */
+uint16_t DEVICES_GetEepromLength(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].eeprom_size;
+}
+
+/** \brief Get EEPROM page size for selected device
+ *
+ * \return EEPROM page size as uint16_t
+ *
+ */
+uint16_t DEVICES_GetEepromPageSize(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].eeprom_pagesize;
+}
+
+/** \brief Get user row address for selected device
+ *
+ * \return User row address as uint16_t
+ *
+ */
+uint16_t DEVICES_GetUserrowAddress(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].userrow_address;
+}
+
+/** \brief Get user row length for selected device
+ *
+ * \return Size of the user row as uint16_t
+ *
+ */
+uint16_t DEVICES_GetUserrowLength(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].userrow_size;
+}
+
+/** \brief Check if the signature is one of the selected device
+ *
+ * \param [in] signature Signature bytes as read from the signature row
+ * \return true if the device has the signature
+ *
+ */
+bool DEVICES_HasSignature(uint8_t *signature)
+{
+  uint16_t key = (signature[1] << 8) | signature[2];
+  uint8_t i;
+
+  if ((SESSION_Current->device_id == DEVICE_UNKNOWN_ID) || (signature[0] != DEVICES_VENDOR_ID) || (key == 0))
+    return false;
+  for (i = 0; i < DEVICES_MAX_SIGNATURES; i++)
+  {
+    if (DEVICES_List[SESSION_Current->device_id].signatures[i] == key)
+      return true;
+  }
+  return false;
+}
+
+/** \brief Get NVM controller version for selected device
+ *
+ * \return NVM version as uint8_t
+ *
+ */
+uint8_t DEVICES_GetNvmVersion(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].nvm_version;
+}
+
+/** \brief Get datasheet page write time for selected device
+ *
+ * \return time in milliseconds as uint16_t, 0 if unknown
+ *
+ */
+uint16_t DEVICES_GetPageWriteTime(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
+    return 0;
+  else
+    return DEVICES_List[SESSION_Current->device_id].page_write_ms;
+}
+
+/** \brief Get datasheet chip erase time for selected device
+ *
+ * \return time in milliseconds as uint16_t, 0 if unknown
+ *
+ */
+uint16_t DEVICES_GetChipEraseTime(void)
+{
+  if (SESSION_Current->device_id == DEVICE_UNKNOWN_ID)
     return 0;
   else
-    return DEVICES_List[DEVICE_Id].number_of_fuses;
+    return DEVICES_List[SESSION_Current->device_id].chip_erase_ms;
 }
 
 /** \brief Get number of devices in the list
@@ -367,7 +1119,7 @@ uint8_t DEVICES_GetFusesNumber(void)
  */
 uint8_t DEVICES_GetNumber(void)
 {
-  return (uint8_t)(sizeof(DEVICES_List) / sizeof(tDevice));
+  return DEVICES_Count;
 }
 
 /** \brief Get string name of the device by ID
@@ -377,7 +1129,7 @@ uint8_t DEVICES_GetNumber(void)
  */
 char *DEVICES_GetNameByNumber(uint8_t number)
 {
-  if (number >= sizeof(DEVICES_List) / sizeof(tDevice))
+  if (number >= DEVICES_Count)
     number = 0;
   return DEVICES_List[number].name;
 }
@@ -2,10 +2,17 @@
 #define DEVICES_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "libupdi.h"
 
 #define DEVICES_NAME_LEN    (16)
 
-#define DEVICE_UNKNOWN_ID   (-1)
+#define DEVICES_MAX             (127)   // IDs are int8_t
+#define DEVICES_MAX_SIGNATURES  (4)
+#define DEVICES_INDEX_SIZE      (512)   // power of 2, above the number of names and signatures
+#define DEVICES_LINE_LEN        (512)
+#define DEVICES_SIGNATURE_LEN   (3)
+#define DEVICES_VENDOR_ID       (0x1E)
 
 #define DEVICE_LOCKBIT_ADDR (0x0A)
 
@@ -21,18 +28,39 @@ typedef struct
   uint16_t fuses_address;
   uint16_t userrow_address;
   uint8_t  number_of_fuses;
+  uint16_t crcscan_address;
+  uint16_t eeprom_start;
+  uint16_t eeprom_size;
+  uint16_t eeprom_pagesize;
+  uint16_t userrow_size;
+  uint16_t signatures[DEVICES_MAX_SIGNATURES];  // 2nd and 3rd signature bytes of the parts, 0 ends the list
+  uint8_t  nvm_version;     // as in SIB, "P:2" is 2
+  uint16_t page_write_ms;   // datasheet timing, 0 if unknown
+  uint16_t chip_erase_ms;
 } tDevice;
 
-extern tDevice DEVICES_List[];
+extern tDevice *DEVICES_List;
 
 int8_t DEVICES_GetId(char *name);
+int8_t DEVICES_GetIdBySignature(uint8_t *signature);
+bool DEVICES_SetId(int8_t id);
+char *DEVICES_GetName(void);
+bool DEVICES_HasSignature(uint8_t *signature);
+uint8_t DEVICES_GetNvmVersion(void);
+uint16_t DEVICES_GetPageWriteTime(void);
+uint16_t DEVICES_GetChipEraseTime(void);
 uint16_t DEVICES_GetFlashLength(void);
 uint16_t DEVICES_GetFlashStart(void);
 uint16_t DEVICES_GetPageSize(void);
 uint16_t DEVICES_GetNvmctrlAddress(void);
 uint16_t DEVICES_GetFusesAddress(void);
+uint16_t DEVICES_GetSigrowAddress(void);
 uint8_t DEVICES_GetFusesNumber(void);
-uint8_t DEVICES_GetNumber(void);
-char *DEVICES_GetNameByNumber(uint8_t number);
+uint16_t DEVICES_GetCrcscanAddress(void);
+uint16_t DEVICES_GetEepromStart(void);
+uint16_t DEVICES_GetEepromLength(void);
+uint16_t DEVICES_GetEepromPageSize(void);
+uint16_t DEVICES_GetUserrowAddress(void);
+uint16_t DEVICES_GetUserrowLength(void);
 
 #endif // DEVICES_H
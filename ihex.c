@@ -2,8 +2,10 @@
 #include <ctype.h>
 #include <string.h>
 #include "ihex.h"
+#include "session.h"
 
-static uint8_t crc;
+// parser state is per thread, sessions may run concurrently
+static SESSION_THREAD uint8_t crc;
 
 /** \brief Convert byte to string with HEX representation
  *
@@ -13,7 +15,7 @@ static uint8_t crc;
  */
 static char* IHEX_AddByte(uint8_t byte)
 {
-  static char res[3];
+  static SESSION_THREAD char res[3];
 
   crc += byte;
   uint8_t n = (byte & 0xF0U) >> 4; // high nybble
@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "bin.h"
+#include "ihex.h"
+#include "image.h"
+#include "log.h"
+#include "session.h"
+#include "srec.h"
+
+typedef struct
+{
+  uint32_t hash;
+  uint8_t  *text;     // file content, a hit must match it byte by byte
+  size_t   len;
+  uint16_t offset;
+  tImage   image;
+} tImageCache;
+
+// each thread has its own cache, cached images are never shared
+static SESSION_THREAD tImageCache IMAGE_Cache[IMAGE_CACHE_SIZE];
+static SESSION_THREAD uint8_t IMAGE_CacheNext = 0;
+
+/** \brief Detect image format from the file content
+ *
+ * \param [in] fp File handle, rewound to the start on exit
+ * \return image format as uint8_t
+ *
+ */
+uint8_t IMAGE_DetectFormat(FILE *fp)
+{
+  uint8_t buf[IMAGE_DETECT_LENGTH];
+  size_t len;
+  size_t i;
+  size_t start;
+  uint8_t format = IMAGE_FORMAT_BIN;
+
+  len = fread(buf, 1, sizeof(buf), fp);
+  rewind(fp);
+
+  // text formats consist of printable chars only
+  for (i = 0; i < len; i++)
+  {
+    if (!isprint(buf[i]) && !isspace(buf[i]))
+      return IMAGE_FORMAT_BIN;
+  }
+  start = 0;
+  while ((start < len) && isspace(buf[start]))
+    start++;
+  if (start + 1 < len)
+  {
+    if (buf[start] == ':')
+      format = IMAGE_FORMAT_IHEX;
+    else
+    if ((buf[start] == SREC_START) && isdigit(buf[start + 1]))
+      format = IMAGE_FORMAT_SREC;
+  }
+
+  return format;
+}
+
+/** \brief Get image format for writing from the file name extension
+ *
+ * \param [in] filename Name of the file
+ * \return image format as uint8_t, Intel HEX by default
+ *
+ */
+uint8_t IMAGE_GetFormatByName(char *filename)
+{
+  char *ext;
+
+  ext = strrchr(filename, '.');
+  if (ext == NULL)
+    return IMAGE_FORMAT_IHEX;
+  ext++;
+  if ((strcasecmp(ext, "bin") == 0) || (strcasecmp(ext, "raw") == 0))
+    return IMAGE_FORMAT_BIN;
+  if ((strcasecmp(ext, "srec") == 0) || (strcasecmp(ext, "s19") == 0) ||
+      (strcasecmp(ext, "s28") == 0) || (strcasecmp(ext, "s37") == 0) ||
+      (strcasecmp(ext, "mot") == 0))
+    return IMAGE_FORMAT_SREC;
+
+  return IMAGE_FORMAT_IHEX;
+}
+
+/** \brief Get printable name of the image format
+ *
+ * \param [in] format Image format
+ * \return format name as string
+ *
+ */
+char *IMAGE_GetFormatName(uint8_t format)
+{
+  switch (format)
+  {
+    case IMAGE_FORMAT_SREC:
+      return "S-record";
+    case IMAGE_FORMAT_BIN:
+      return "binary";
+    default:
+      return "Intel HEX";
+  }
+}
+
+/** \brief Load image of any supported format from opened stream into memory
+ *
+ * \param [out] image Image to fill, data buffer is allocated here
+ * \param [in] fp Stream handle
+ * \param [in] name Name of the image for messages
+ * \param [in] size Size of the target memory
+ * \param [in] offset Load offset for binary files
+ * \return true if succeed
+ *
+ */
+bool IMAGE_LoadStream(tImage *image, FILE *fp, char *name, uint16_t size, uint16_t offset)
+{
+  uint8_t format;
+  uint8_t errCode;
+
+  memset(image, 0, sizeof(tImage));
+  image->data = malloc(size);
+  if (!image->data)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %d bytes", (int)size);
+    return false;
+  }
+  // not programmed cells stay erased
+  memset(image->data, 0xff, size);
+  image->size = size;
+  image->min_addr = 0xFFFF;
+  image->max_addr = 0;
+
+  format = IMAGE_DetectFormat(fp);
+  LOG_Print(LOG_LEVEL_INFO, "Reading %s file: %s", IMAGE_GetFormatName(format), name);
+  switch (format)
+  {
+    case IMAGE_FORMAT_SREC:
+      errCode = SREC_ReadFile(fp, image->data, size, &image->min_addr, &image->max_addr);
+      break;
+    case IMAGE_FORMAT_BIN:
+      errCode = BIN_ReadFile(fp, image->data, size, offset, &image->min_addr, &image->max_addr);
+      break;
+    default:
+      errCode = IHEX_ReadFile(fp, image->data, size, &image->min_addr, &image->max_addr);
+      break;
+  }
+  // all formats share the same error numbering
+  if (errCode != IHEX_ERROR_NONE)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Problem reading %s file", IMAGE_GetFormatName(format));
+    IMAGE_Free(image);
+    return false;
+  }
+  if (image->min_addr > image->max_addr)
+    image->min_addr = image->max_addr;
+
+  return true;
+}
+
+/** \brief Load image file of any supported format into memory
+ *
+ * \param [out] image Image to fill, data buffer is allocated here
+ * \param [in] filename Name of the file
+ * \param [in] size Size of the target memory
+ * \param [in] offset Load offset for binary files
+ * \return true if succeed
+ *
+ */
+bool IMAGE_Load(tImage *image, char *filename, uint16_t size, uint16_t offset)
+{
+  FILE *fp;
+  bool res;
+
+  memset(image, 0, sizeof(tImage));
+  if ((fp = fopen(filename, "rb")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  res = IMAGE_LoadStream(image, fp, filename, size, offset);
+  fclose(fp);
+
+  return res;
+}
+
+/** \brief Read the whole stream content and calculate its FNV-1a hash
+ *
+ * \param [in] fp Stream handle, rewound to the start on exit
+ * \param [out] len Length of the content
+ * \param [out] hash Hash of the content
+ * \return content buffer to be freed by the caller, NULL on error
+ *
+ */
+static uint8_t *IMAGE_ReadText(FILE *fp, size_t *len, uint32_t *hash)
+{
+  uint8_t buf[256];
+  uint8_t *text = NULL;
+  uint8_t *tmp;
+  size_t n;
+  size_t i;
+
+  *len = 0;
+  *hash = 2166136261U;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+  {
+    if ((tmp = realloc(text, *len + n)) == NULL)
+    {
+      free(text);
+      rewind(fp);
+      return NULL;
+    }
+    text = tmp;
+    memcpy(&text[*len], buf, n);
+    *len += n;
+    for (i = 0; i < n; i++)
+    {
+      *hash ^= buf[i];
+      *hash *= 16777619U;
+    }
+  }
+  rewind(fp);
+
+  return text;
+}
+
+/** \brief Load image from stream, reusing already parsed images with the same content
+ *
+ * Returned image is owned by the cache, IMAGE_Free only detaches it.
+ *
+ * \param [out] image Image to fill
+ * \param [in] fp Stream handle
+ * \param [in] name Name of the image for messages
+ * \param [in] size Size of the target memory
+ * \param [in] offset Load offset for binary files
+ * \return true if succeed
+ *
+ */
+bool IMAGE_LoadCached(tImage *image, FILE *fp, char *name, uint16_t size, uint16_t offset)
+{
+  tImageCache *entry;
+  uint8_t *text;
+  uint32_t hash;
+  size_t len;
+  uint8_t i;
+
+  // without the content to compare with the image is not cached
+  if ((text = IMAGE_ReadText(fp, &len, &hash)) == NULL)
+    return IMAGE_LoadStream(image, fp, name, size, offset);
+  for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+  {
+    entry = &IMAGE_Cache[i];
+    if ((entry->image.data != NULL) && (entry->hash == hash) && (entry->len == len) &&
+        (entry->image.size == size) && (entry->offset == offset) && (memcmp(entry->text, text, len) == 0))
+    {
+      LOG_Print(LOG_LEVEL_INFO, "Using cached image for %s", name);
+      free(text);
+      *image = entry->image;
+      return true;
+    }
+  }
+  // replace the oldest entry
+  entry = &IMAGE_Cache[IMAGE_CacheNext];
+  IMAGE_CacheNext = (IMAGE_CacheNext + 1) % IMAGE_CACHE_SIZE;
+  entry->image.cached = false;
+  IMAGE_Free(&entry->image);
+  free(entry->text);
+  entry->text = NULL;
+  entry->len = 0;
+  if (IMAGE_LoadStream(&entry->image, fp, name, size, offset) == false)
+  {
+    free(text);
+    return false;
+  }
+  entry->image.cached = true;
+  entry->hash = hash;
+  entry->text = text;
+  entry->len = len;
+  entry->offset = offset;
+  *image = entry->image;
+
+  return true;
+}
+
+/** \brief Release all cached images
+ *
+ * \return Nothing
+ *
+ */
+void IMAGE_FreeCache(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+  {
+    IMAGE_Cache[i].image.cached = false;
+    IMAGE_Free(&IMAGE_Cache[i].image);
+    free(IMAGE_Cache[i].text);
+    IMAGE_Cache[i].text = NULL;
+    IMAGE_Cache[i].len = 0;
+  }
+}
+
+/** \brief Free memory used by image
+ *
+ * \param [in] image Image to release
+ * \return Nothing
+ *
+ */
+void IMAGE_Free(tImage *image)
+{
+  // cached images stay in memory for the next use
+  if (image->cached == false)
+    free(image->data);
+  image->data = NULL;
+  image->size = 0;
+}
+
+/** \brief Save memory buffer to file, format is taken from the file extension
+ *
+ * \param [in] filename Name of the file
+ * \param [in] data Data buffer
+ * \param [in] len Length of data
+ * \return true if succeed
+ *
+ */
+bool IMAGE_Save(char *filename, uint8_t *data, uint16_t len)
+{
+  FILE *fp;
+  uint8_t format;
+  uint8_t errCode;
+
+  format = IMAGE_GetFormatByName(filename);
+  if ((fp = fopen(filename, (format == IMAGE_FORMAT_BIN) ? "wb" : "w")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  switch (format)
+  {
+    case IMAGE_FORMAT_SREC:
+      errCode = SREC_WriteFile(fp, data, len);
+      break;
+    case IMAGE_FORMAT_BIN:
+      errCode = BIN_WriteFile(fp, data, len);
+      break;
+    default:
+      errCode = IHEX_WriteFile(fp, data, len);
+      break;
+  }
+  fclose(fp);
+  if (errCode != IHEX_ERROR_NONE)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Problem writing %s file", IMAGE_GetFormatName(format));
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "libupdi.h"
+
+#define IMAGE_DETECT_LENGTH   (32)
+#define IMAGE_CACHE_SIZE      (8)
+
+enum {
+  IMAGE_FORMAT_IHEX,
+  IMAGE_FORMAT_SREC,
+  IMAGE_FORMAT_BIN
+};
+
+typedef struct
+{
+  uint8_t  *data;
+  uint16_t size;
+  uint16_t min_addr;
+  uint16_t max_addr;
+  bool     cached;
+} tImage;
+
+uint8_t IMAGE_DetectFormat(FILE *fp);
+uint8_t IMAGE_GetFormatByName(char *filename);
+char *IMAGE_GetFormatName(uint8_t format);
+bool IMAGE_Load(tImage *image, char *filename, uint16_t size, uint16_t offset);
+bool IMAGE_LoadStream(tImage *image, FILE *fp, char *name, uint16_t size, uint16_t offset);
+bool IMAGE_LoadCached(tImage *image, FILE *fp, char *name, uint16_t size, uint16_t offset);
+void IMAGE_Free(tImage *image);
+bool IMAGE_Save(char *filename, uint8_t *data, uint16_t len);
+
+#endif
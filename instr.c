@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "instr.h"
+
+#ifdef UPDI_INSTRUMENT
+/**< counters are shared by all sessions, meant for a single session debug build */
+static tInstrPoint INSTR_Points[INSTR_POINTS];
+static uint8_t INSTR_Opcode = INSTR_OP_LDS;
+static uint32_t INSTR_Baudrate = 0;
+static bool INSTR_Registered = false;
+
+static const char *INSTR_Names[INSTR_POINTS] = {
+  "PHY_Send", "PHY_Receive", "COM write", "COM read", "NVM busy",
+  "LDS", "LD", "STS", "ST", "LDCS", "REPEAT", "STCS", "KEY"
+};
+
+/** \brief Add latency sample to the point histogram
+ *
+ * \param [in] point Instrumentation point
+ * \param [in] start Start time of the sample in microseconds
+ * \return Nothing
+ *
+ */
+static void INSTR_AddSample(uint8_t point, uint64_t start)
+{
+  tInstrPoint *p = &INSTR_Points[point];
+  uint64_t time = STATS_GetTime() - start;
+  uint8_t bucket = 0;
+
+  while (((time >> bucket) > 1) && (bucket < (INSTR_HIST_LEN - 1)))
+    bucket++;
+  p->hist[bucket]++;
+  p->samples++;
+  p->time_us += time;
+  if (INSTR_Registered == false)
+  {
+    INSTR_Registered = true;
+    atexit(INSTR_Dump);
+  }
+}
+
+/** \brief Record call of an instrumented function
+ *
+ * \param [in] point Instrumentation point
+ * \param [in] bytes Bytes moved by the call
+ * \param [in] start Start time of the call in microseconds
+ * \return Nothing
+ *
+ */
+void INSTR_Record(uint8_t point, uint32_t bytes, uint64_t start)
+{
+  INSTR_Points[point].calls++;
+  INSTR_Points[point].bytes += bytes;
+  INSTR_AddSample(point, start);
+}
+
+/** \brief Record timeout at the point
+ *
+ * \param [in] point Instrumentation point
+ * \return Nothing
+ *
+ */
+void INSTR_Timeout(uint8_t point)
+{
+  INSTR_Points[point].timeouts++;
+}
+
+/** \brief Record UPDI frame, following responses are accounted to its opcode
+ *
+ * \param [in] frame Frame starting with SYNC
+ * \param [in] len Length of frame
+ * \return Nothing
+ *
+ */
+void INSTR_Frame(uint8_t *frame, uint8_t len)
+{
+  INSTR_Opcode = INSTR_OP_LDS + (frame[1] >> 5);
+  INSTR_Points[INSTR_Opcode].calls++;
+  INSTR_Points[INSTR_Opcode].bytes += len;
+}
+
+/** \brief Record response to the last UPDI frame
+ *
+ * \param [in] start Time when waiting for the response started
+ * \param [in] ok false if response timed out
+ * \return Nothing
+ *
+ */
+void INSTR_Response(uint64_t start, bool ok)
+{
+  INSTR_AddSample(INSTR_Opcode, start);
+  if (ok == false)
+    INSTR_Timeout(INSTR_Opcode);
+}
+
+/** \brief Remember baudrate for the wire time estimation
+ *
+ * \param [in] baudrate Port baudrate
+ * \return Nothing
+ *
+ */
+void INSTR_SetBaudrate(uint32_t baudrate)
+{
+  INSTR_Baudrate = baudrate;
+}
+
+/** \brief Print counters and histograms to stderr, called at exit
+ *
+ * \return Nothing
+ *
+ */
+void INSTR_Dump(void)
+{
+  tInstrPoint *p;
+  uint64_t wire = 0;
+  uint64_t link;
+  uint8_t i, j;
+
+  fprintf(stderr, "\n%-12s %8s %9s %8s %10s %9s  histogram (<us:count)\n",
+          "point", "calls", "bytes", "timeouts", "total ms", "avg us");
+  for (i = 0; i < INSTR_POINTS; i++)
+  {
+    p = &INSTR_Points[i];
+    if ((p->calls == 0) && (p->samples == 0))
+      continue;
+    fprintf(stderr, "%-12s %8u %9u %8u %10.3f %9.1f ", INSTR_Names[i], p->calls, p->bytes, p->timeouts,
+            p->time_us / 1000.0, (p->samples > 0) ? (double)p->time_us / p->samples : 0.0);
+    for (j = 0; j < INSTR_HIST_LEN; j++)
+    {
+      if (p->hist[j] > 0)
+        fprintf(stderr, " %lu:%u", 2UL << j, p->hist[j]);
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // echo of sent bytes arrives while they are sent, so the wire sees every byte once
+  if (INSTR_Baudrate > 0)
+    wire = (uint64_t)(INSTR_Points[INSTR_PHY_SEND].bytes + INSTR_Points[INSTR_PHY_RECEIVE].bytes) *
+           STATS_BITS_PER_BYTE * 1000000 / INSTR_Baudrate;
+  link = INSTR_Points[INSTR_PHY_SEND].time_us + INSTR_Points[INSTR_PHY_RECEIVE].time_us;
+  fprintf(stderr, "link %.3f ms = wire %.3f ms + adapter and turnaround %.3f ms, NVM busy %.3f ms\n",
+          link / 1000.0, wire / 1000.0, ((link > wire) ? (link - wire) : 0) / 1000.0,
+          INSTR_Points[INSTR_NVM_BUSY].time_us / 1000.0);
+}
+#endif
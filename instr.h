@@ -0,0 +1,65 @@
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**< Hot path instrumentation, built in with -DUPDI_INSTRUMENT only.
+     Without it every hook below expands to nothing. */
+
+#define INSTR_HIST_LEN      (24)    // log2 buckets of microseconds, up to 8 s
+
+enum {
+  INSTR_PHY_SEND,       // send and echo
+  INSTR_PHY_RECEIVE,    // request to response
+  INSTR_COM_WRITE,      // write syscalls
+  INSTR_COM_READ,       // read syscalls
+  INSTR_NVM_BUSY,       // waiting for NVM controller
+  INSTR_OP_LDS,         // UPDI opcodes in the order of their code
+  INSTR_OP_LD,
+  INSTR_OP_STS,
+  INSTR_OP_ST,
+  INSTR_OP_LDCS,
+  INSTR_OP_REPEAT,
+  INSTR_OP_STCS,
+  INSTR_OP_KEY,
+  INSTR_POINTS
+};
+
+typedef struct
+{
+  uint32_t  calls;
+  uint32_t  bytes;
+  uint32_t  timeouts;
+  uint32_t  samples;
+  uint64_t  time_us;
+  uint32_t  hist[INSTR_HIST_LEN];
+} tInstrPoint;
+
+#ifdef UPDI_INSTRUMENT
+#include "stats.h"
+
+#define INSTR_TIME(var)                   uint64_t var = STATS_GetTime()
+#define INSTR_RECORD(point, bytes, start) INSTR_Record(point, bytes, start)
+#define INSTR_TIMEOUT(point)              INSTR_Timeout(point)
+#define INSTR_FRAME(frame, len)           INSTR_Frame(frame, len)
+#define INSTR_RESPONSE(start, ok)         INSTR_Response(start, ok)
+#define INSTR_BAUDRATE(baudrate)          INSTR_SetBaudrate(baudrate)
+
+void INSTR_Record(uint8_t point, uint32_t bytes, uint64_t start);
+void INSTR_Timeout(uint8_t point);
+void INSTR_Frame(uint8_t *frame, uint8_t len);
+void INSTR_Response(uint64_t start, bool ok);
+void INSTR_SetBaudrate(uint32_t baudrate);
+void INSTR_Dump(void);
+#else
+// INSTR_TIME declares a variable, the others are statements and must stay ones
+#define INSTR_TIME(var)
+#define INSTR_RECORD(point, bytes, start) do {} while (0)
+#define INSTR_TIMEOUT(point)              do {} while (0)
+#define INSTR_FRAME(frame, len)           do {} while (0)
+#define INSTR_RESPONSE(start, ok)         do {} while (0)
+#define INSTR_BAUDRATE(baudrate)          do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef LIBUPDI_H
+#define LIBUPDI_H
+
+/**< public interface of libupdi, it needs no other header of the library.
+     Every session call takes the session it works on, so sessions can be
+     driven from any thread and several of them from one thread. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PLAN_MAX_STEPS      (32)
+#define PLAN_FILENAME_LEN   (128)
+#define PLAN_LINE_LEN       (256)
+#define PLAN_FUSES_MAX      (16)
+#define PROGRESS_PREFIX_LEN (16)
+#define SESSION_BAUDRATE    (115200)    // default UPDI baudrate
+
+#define DEVICE_UNKNOWN_ID   (-1)
+#define DEVICE_AUTO_ID      (-2)
+#define DEVICES_AUTO        "auto"      // device type is detected from the signature
+
+enum {
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_LAST
+};
+
+enum {
+  PLAN_OP_UNLOCK,
+  PLAN_OP_BLANK_CHECK,
+  PLAN_OP_ERASE,
+  PLAN_OP_FUSES_WRITE,
+  PLAN_OP_WRITE,
+  PLAN_OP_FUSES_READ,
+  PLAN_OP_VERIFY,
+  PLAN_OP_READ,
+  PLAN_OP_LOCK
+};
+
+enum {
+  PLAN_MEM_NONE,
+  PLAN_MEM_FLASH,
+  PLAN_MEM_EEPROM,
+  PLAN_MEM_USERROW
+};
+
+typedef struct
+{
+  uint8_t   op;
+  uint8_t   memory;
+  uint16_t  mask;
+  uint8_t   fuses[PLAN_FUSES_MAX];
+  char      file[PLAN_FILENAME_LEN];
+} tPlanStep;
+
+typedef struct
+{
+  tPlanStep steps[PLAN_MAX_STEPS];
+  uint8_t   number;
+  bool      verify;
+  bool      verify_crc;
+  bool      auto_erase;
+  bool      app_only;     // flash steps keep the boot and application data sections
+  uint16_t  offset;
+  FILE      *(*open)(char *name);   // image source, images are cached if set
+} tPlan;
+
+typedef struct
+{
+  char      prefix[PROGRESS_PREFIX_LEN];
+  uint32_t  done;           // bytes
+  uint32_t  total;
+  uint32_t  bytes_per_s;
+  uint32_t  eta_ms;
+  uint32_t  retries;
+  bool      finished;
+  bool      failed;
+} tProgress;
+
+typedef void (*tProgressCallback)(tProgress *progress, void *arg);
+
+#ifndef SESSION_TYPEDEF
+#define SESSION_TYPEDEF
+typedef struct tSession tSession;
+#endif
+
+bool DEVICES_Load(char *filename);
+uint8_t DEVICES_GetNumber(void);
+char *DEVICES_GetNameByNumber(uint8_t number);
+int8_t DEVICES_GetNumberByName(char *name);
+
+bool LOG_Start(FILE *fp, bool binary);
+void LOG_Stop(void);
+
+bool CAPTURE_Decode(char *filename);
+
+void IMAGE_FreeCache(void);
+
+void PLAN_Init(tPlan *plan);
+bool PLAN_AddStep(tPlan *plan, uint8_t op, uint8_t memory, char *arg);
+bool PLAN_AddLine(tPlan *plan, char *line);
+bool PLAN_LoadFile(tPlan *plan, char *filename);
+void PLAN_Optimize(tPlan *plan);
+void PLAN_Print(tPlan *plan);
+
+tSession *SESSION_Open(char *port, uint32_t baudrate, char *device, bool connect);
+void SESSION_Close(tSession *session);
+void SESSION_Select(tSession *session);
+bool SESSION_SetDevice(tSession *session, char *device);
+void SESSION_SetLogLevel(tSession *session, uint8_t level);
+void SESSION_SetProgressCallback(tSession *session, tProgressCallback callback, void *arg);
+bool SESSION_Connect(tSession *session);
+bool SESSION_Probe(tSession *session);
+bool SESSION_Execute(tSession *session, tPlan *plan);
+void SESSION_ResetStats(tSession *session);
+void SESSION_PrintStats(tSession *session, FILE *fp, bool result);
+bool SESSION_LoadTiming(tSession *session, char *filename);
+bool SESSION_SaveTiming(tSession *session, char *filename);
+bool SESSION_LoadCheckpoint(tSession *session, char *filename);
+bool SESSION_SaveCheckpoint(tSession *session, char *filename);
+bool SESSION_StartCapture(tSession *session, char *filename);
+void SESSION_StopCapture(tSession *session);
+bool SESSION_StartReplay(tSession *session, char *filename, float scale);
+bool SESSION_StopReplay(tSession *session);
+
+#endif
@@ -1,8 +1,41 @@
 #include <string.h>
+#include "instr.h"
+#include "link.h"
 #include "log.h"
 #include "phy.h"
+#include "stats.h"
 #include "updi.h"
 
+/** \brief Send UPDI frame starting with SYNC
+ *
+ * \param [in] frame Frame data
+ * \param [in] len Length of frame
+ * \return Nothing
+ *
+ */
+static void LINK_SendFrame(uint8_t *frame, uint8_t len)
+{
+  STATS_AddFrame();
+  INSTR_FRAME(frame, len);
+  PHY_Send(frame, len);
+}
+
+/** \brief Receive ACK of the last store
+ *
+ * \return true if ACK received
+ *
+ */
+static bool LINK_GetAck(void)
+{
+  uint8_t response = 0;
+
+  PHY_Receive(&response, 1);
+  if (response == UPDI_PHY_ACK)
+    return true;
+  STATS_AddAckFailure();
+  return false;
+}
+
 /** \brief
  *
  * \param
@@ -16,8 +49,8 @@ uint8_t LINK_ldcs(uint8_t address)
   uint8_t response = 0;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_LDCS | (address & 0x0F)};
 
-  LOG_Print(LOG_LEVEL_INFO, "LDCS from 0x%02X", address);
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("LDCS from 0x%02X", address);
+  LINK_SendFrame(buf, sizeof(buf));
   PHY_Receive(&response, 1);
   return response;
 }
@@ -34,8 +67,8 @@ void LINK_stcs(uint8_t address, uint8_t value)
   //Store a value to Control/Status space
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_STCS | (address & 0x0F), value};
 
-  LOG_Print(LOG_LEVEL_INFO, "STCS to 0x%02X", address);
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("STCS to 0x%02X", address);
+  LINK_SendFrame(buf, sizeof(buf));
 }
 
 /** \brief
@@ -50,7 +83,7 @@ bool LINK_Check(void)
   //Check UPDI by loading CS STATUSA
   if (LINK_ldcs(UPDI_CS_STATUSA) != 0)
   {
-    LOG_Print(LOG_LEVEL_INFO, "UPDI init OK");
+    LOG_INFO("UPDI init OK");
     return true;
   }
   LOG_Print(LOG_LEVEL_WARNING, "UPDI not OK - reinitialisation required");
@@ -80,28 +113,77 @@ void LINK_Start(void)
  */
 bool LINK_Init(char *port, uint32_t baudrate, bool onDTR)
 {
-  uint8_t err = 3;
-  uint8_t byte;
-
   //Create a UPDI physical connection
   if (PHY_Init(port, baudrate, onDTR) == false)
     return false;
-  byte = UPDI_BREAK;
+  return LINK_Connect(port, baudrate);
+}
+
+/** \brief Check quickly if a target answers, without the double break
+ *
+ * \return true if target is present
+ *
+ */
+bool LINK_Probe(void)
+{
+  uint8_t byte = UPDI_BREAK;
+
+  // zero frame enables UPDI of a freshly seated target
   PHY_Send(&byte, sizeof(uint8_t));
-  while (err-- > 0)
+  LINK_Start();
+  return (LINK_ldcs(UPDI_CS_STATUSA) != 0);
+}
+
+/** \brief Poll STATUSA until the target answers, at least once
+ *
+ * \return true if target answers
+ *
+ */
+static bool LINK_Resync(void)
+{
+  uint64_t deadline = STATS_GetTime() + LINK_RESYNC_US;
+  uint64_t now;
+  bool res = false;
+
+  //Reads wait for the rest of the resync time only, not for the port timeout
+  while ((res == false) && ((now = STATS_GetTime()) < deadline))
   {
+    PHY_SetTimeout((uint32_t)(deadline - now));
     LINK_Start();
     //Check answer
-    if (LINK_Check() == true)
-      return true;
-    //Send double break if all is not well, and re-check
-    if (PHY_DoBreak(port) == false)
+    res = LINK_Check();
+  }
+  PHY_SetTimeout(0);
+  return res;
+}
+
+/** \brief Bring up UPDI link on already opened port, escalating from
+ *         a zero frame to a single break and to double breaks
+ *
+ * \param [in] port Port name, used to reopen it if it can't send a break
+ * \param [in] baudrate Port baudrate
+ * \return true if succeed
+ *
+ */
+bool LINK_Connect(char *port, uint32_t baudrate)
+{
+  uint8_t tries;
+  uint8_t byte;
+
+  byte = UPDI_BREAK;
+  PHY_Send(&byte, sizeof(uint8_t));
+  if (LINK_Resync() == true)
+    return true;
+  for (tries = 1; tries <= LINK_BREAK_TRIES; tries++)
+  {
+    //Send break if all is not well, and re-check
+    if (PHY_DoBreak(port, baudrate, (tries == 1) ? 1 : 2) == false)
     {
       LOG_Print(LOG_LEVEL_ERROR, "UPDI initialisation failed");
       return false;
     }
-    if (PHY_Init(port, baudrate, onDTR) == false)
-      return false;
+    if (LINK_Resync() == true)
+      return true;
   }
   return false;
 }
@@ -119,8 +201,8 @@ uint8_t LINK_ld(uint16_t address)
   uint8_t response;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_LDS | UPDI_ADDRESS_16 | UPDI_DATA_8, address & 0xFF, (address >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "LD from 0x%04X", address);
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("LD from 0x%04X", address);
+  LINK_SendFrame(buf, sizeof(buf));
   PHY_Receive(&response, 1);
   return response;
 }
@@ -138,8 +220,8 @@ uint16_t LINK_ld16(uint16_t address)
   uint16_t response;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_LDS | UPDI_ADDRESS_16 | UPDI_DATA_16, address & 0xFF, (address >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "LD from 0x%04X", address);
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("LD from 0x%04X", address);
+  LINK_SendFrame(buf, sizeof(buf));
   PHY_Receive((uint8_t*)&response, 2);
   return response;
 }
@@ -154,18 +236,15 @@ uint16_t LINK_ld16(uint16_t address)
 bool LINK_st(uint16_t address, uint8_t value)
 {
   //Store a single byte value directly to a 16-bit address
-  uint8_t response;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_STS | UPDI_ADDRESS_16 | UPDI_DATA_8, address & 0xFF, (address >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "ST to 0x%04X", address);
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  LOG_INFO("ST to 0x%04X", address);
+  LINK_SendFrame(buf, sizeof(buf));
+  if (LINK_GetAck() == false)
     return false;
 
   PHY_Send(&value, 1);
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  if (LINK_GetAck() == false)
     return false;
 
   return true;
@@ -181,18 +260,15 @@ bool LINK_st(uint16_t address, uint8_t value)
 bool LINK_st16(uint16_t address, uint16_t value)
 {
   //Store a 16-bit word value directly to a 16-bit address
-  uint8_t response;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_STS | UPDI_ADDRESS_16 | UPDI_DATA_16, address & 0xFF, (address >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "ST to 0x%04X", address);
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  LOG_INFO("ST to 0x%04X", address);
+  LINK_SendFrame(buf, sizeof(buf));
+  if (LINK_GetAck() == false)
     return false;
 
   PHY_Send((uint8_t*)&value, sizeof(uint16_t));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  if (LINK_GetAck() == false)
     return false;
 
   return true;
@@ -205,13 +281,13 @@ bool LINK_st16(uint16_t address, uint16_t value)
  * \return true if succeed
  *
  */
-bool LINK_ld_ptr_inc(uint8_t *data, uint8_t size)
+bool LINK_ld_ptr_inc(uint8_t *data, uint16_t size)
 {
   //Loads a number of bytes from the pointer location with pointer post-increment
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_LD | UPDI_PTR_INC | UPDI_DATA_8};
 
-  LOG_Print(LOG_LEVEL_INFO, "LD8 from ptr++");
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("LD8 from ptr++");
+  LINK_SendFrame(buf, sizeof(buf));
 
   return PHY_Receive(data, size);
 }
@@ -228,8 +304,8 @@ bool LINK_ld_ptr_inc16(uint8_t *data, uint16_t words)
   //Load a 16-bit word value from the pointer location with pointer post-increment
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_LD | UPDI_PTR_INC | UPDI_DATA_16};
 
-  LOG_Print(LOG_LEVEL_INFO, "LD16 from ptr++");
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("LD16 from ptr++");
+  LINK_SendFrame(buf, sizeof(buf));
 
   return PHY_Receive(data, words << 1);
 }
@@ -244,13 +320,11 @@ bool LINK_ld_ptr_inc16(uint8_t *data, uint16_t words)
 bool LINK_st_ptr(uint16_t address)
 {
   //Set the pointer location
-  uint8_t response;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_ST | UPDI_PTR_ADDRESS | UPDI_DATA_16, address & 0xFF, (address >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "ST to ptr");
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  LOG_INFO("ST to ptr");
+  LINK_SendFrame(buf, sizeof(buf));
+  if (LINK_GetAck() == false)
     return false;
   return true;
 }
@@ -265,22 +339,19 @@ bool LINK_st_ptr(uint16_t address)
 bool LINK_st_ptr_inc(uint8_t *data, uint16_t len)
 {
   //Store data to the pointer location with pointer post-increment
-  uint8_t response;
   uint16_t n;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_ST | UPDI_PTR_INC | UPDI_DATA_8, data[0]};
 
-  LOG_Print(LOG_LEVEL_INFO, "ST8 to *ptr++");
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  LOG_INFO("ST8 to *ptr++");
+  LINK_SendFrame(buf, sizeof(buf));
+  if (LINK_GetAck() == false)
     return false;
 
   n = 1;
   while (n < len)
   {
     PHY_Send(&data[n], sizeof(uint8_t));
-    PHY_Receive(&response, 1);
-    if (response != UPDI_PHY_ACK)
+    if (LINK_GetAck() == false)
       return false;
     n++;
   }
@@ -291,22 +362,19 @@ bool LINK_st_ptr_inc(uint8_t *data, uint16_t len)
 bool LINK_st_ptr_inc16(uint8_t *data, uint16_t len) // length in words or in bytes??
 {
   //Store a 16-bit word value to the pointer location with pointer post-increment
-  uint8_t response;
   uint16_t n;
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_ST | UPDI_PTR_INC | UPDI_DATA_16, data[0], data[1]};
 
-  LOG_Print(LOG_LEVEL_INFO, "ST16 to *ptr++");
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(&response, 1);
-  if (response != UPDI_PHY_ACK)
+  LOG_INFO("ST16 to *ptr++");
+  LINK_SendFrame(buf, sizeof(buf));
+  if (LINK_GetAck() == false)
     return false;
 
   n = 2;
   while (n < len)
   {
     PHY_Send(&data[n], sizeof(uint16_t));
-    PHY_Receive(&response, 1);
-    if (response != UPDI_PHY_ACK)
+    if (LINK_GetAck() == false)
       return false;
     n += 2;
   }
@@ -325,47 +393,43 @@ void LINK_Repeat(uint16_t repeats)
   //Store a value to the repeat counter
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_REPEAT | UPDI_REPEAT_WORD, (repeats - 1) & 0xFF, ((repeats - 1) >> 8) & 0xFF};
 
-  LOG_Print(LOG_LEVEL_INFO, "Repeat %d", repeats);
-  PHY_Send(buf, sizeof(buf));
+  LOG_INFO("Repeat %d", repeats);
+  LINK_SendFrame(buf, sizeof(buf));
 }
 
-/** \brief
+/** \brief Read System Information Block
  *
- * \param
- * \param
- * \return
+ * \param [out] data Buffer for UPDI_SIB_LENGTH bytes
+ * \return true if succeed
  *
  */
-void LINK_Read_SIB(uint8_t *data)
+bool LINK_Read_SIB(uint8_t *data)
 {
   //Read the SIB
   uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_KEY | UPDI_KEY_SIB | UPDI_SIB_16BYTES};
 
-  PHY_Send(buf, sizeof(buf));
-  PHY_Receive(data, UPDI_SIB_LENGTH);
+  LOG_INFO("Reading SIB");
+  LINK_SendFrame(buf, sizeof(buf));
+  return PHY_Receive(data, UPDI_SIB_LENGTH);
 }
 
-/** \brief
+/** \brief Build key payload, the key is sent last character first
  *
- * \param
- * \param
- * \return
+ * \param [in] key Key as string
+ * \param [in] size Key size
+ * \param [out] data Buffer of LINK_KEY_LEN bytes for the payload
+ * \return payload length, 0 if the key length is invalid
  *
  */
-bool LINK_SendKey(char *key, uint8_t size)
+static uint8_t LINK_KeyPayload(char *key, uint8_t size, uint8_t *data)
 {
-  //Write a key
-  uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_KEY | UPDI_KEY_KEY | size};
-  uint8_t data[8];
   uint8_t n, i;
 
-  LOG_Print(LOG_LEVEL_INFO, "Writing key");
-  if (strlen(key) != (8 << size))
+  if ((strlen(key) != (size_t)(8 << size)) || (strlen(key) > LINK_KEY_LEN))
   {
     LOG_Print(LOG_LEVEL_ERROR, "Invalid KEY length!");
-    return false;
+    return 0;
   }
-  PHY_Send(buf, sizeof(buf));
   n = strlen(key);
   i = 0;
   while (n > 0)
@@ -373,7 +437,75 @@ bool LINK_SendKey(char *key, uint8_t size)
     data[i++] = key[n - 1];
     n--;
   }
-  PHY_Send(data, sizeof(data));
+  return i;
+}
+
+/** \brief
+ *
+ * \param
+ * \param
+ * \return
+ *
+ */
+bool LINK_SendKey(char *key, uint8_t size)
+{
+  //Write a key
+  uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_KEY | UPDI_KEY_KEY | size};
+  uint8_t data[LINK_KEY_LEN];
+  uint8_t len;
+
+  LOG_INFO("Writing key");
+  if ((len = LINK_KeyPayload(key, size, data)) == 0)
+    return false;
+  LINK_SendFrame(buf, sizeof(buf));
+  PHY_Send(data, len);
 
   return true;
 }
+
+/** \brief Write a key and load KEY_STATUS in one transfer
+ *
+ * \param [in] key Key as string
+ * \param [in] size Key size
+ * \return KEY_STATUS as uint8_t, 0 if the key is invalid or no answer
+ *
+ */
+uint8_t LINK_SendKeyStatus(char *key, uint8_t size)
+{
+  uint8_t buf[2 + LINK_KEY_LEN + 2] = {UPDI_PHY_SYNC, UPDI_KEY | UPDI_KEY_KEY | size};
+  uint8_t response = 0;
+  uint8_t i;
+
+  LOG_INFO("Writing key, LDCS from 0x%02X", UPDI_ASI_KEY_STATUS);
+  if ((i = LINK_KeyPayload(key, size, &buf[2])) == 0)
+    return 0;
+  i += 2;
+  buf[i++] = UPDI_PHY_SYNC;
+  buf[i++] = UPDI_LDCS | UPDI_ASI_KEY_STATUS;
+  STATS_AddFrame();
+  LINK_SendFrame(buf, i);
+  PHY_Receive(&response, 1);
+  return response;
+}
+
+/** \brief Apply and release reset, then load a Control/Status register,
+ *         all in one transfer
+ *
+ * \param [in] address Control/Status register address
+ * \return register value as uint8_t
+ *
+ */
+uint8_t LINK_ResetStatus(uint8_t address)
+{
+  uint8_t response = 0;
+  uint8_t buf[] = {UPDI_PHY_SYNC, UPDI_STCS | UPDI_ASI_RESET_REQ, UPDI_RESET_REQ_VALUE,
+                   UPDI_PHY_SYNC, UPDI_STCS | UPDI_ASI_RESET_REQ, 0x00,
+                   UPDI_PHY_SYNC, UPDI_LDCS | (address & 0x0F)};
+
+  LOG_INFO("Toggle reset, LDCS from 0x%02X", address);
+  STATS_AddFrame();
+  STATS_AddFrame();
+  LINK_SendFrame(buf, sizeof(buf));
+  PHY_Receive(&response, 1);
+  return response;
+}
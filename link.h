@@ -4,18 +4,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#define LINK_BREAK_TRIES  (3)       // single break first, double breaks after it
+#define LINK_RESYNC_US    (20000)   // polling of STATUSA after a break
+#define LINK_KEY_LEN      (8)
+
 uint8_t LINK_ldcs(uint8_t address);
 void LINK_stcs(uint8_t address, uint8_t value);
 bool LINK_Init(char *port, uint32_t baudrate, bool onDTR);
+bool LINK_Connect(char *port, uint32_t baudrate);
+bool LINK_Probe(void);
 bool LINK_SendKey(char *key, uint8_t size);
+uint8_t LINK_SendKeyStatus(char *key, uint8_t size);
+uint8_t LINK_ResetStatus(uint8_t address);
 uint8_t LINK_ld(uint16_t address);
 bool LINK_st(uint16_t address, uint8_t value);
 bool LINK_st16(uint16_t address, uint16_t value);
 void LINK_Repeat(uint16_t repeats);
-bool LINK_ld_ptr_inc(uint8_t *data, uint8_t size);
+bool LINK_ld_ptr_inc(uint8_t *data, uint16_t size);
 bool LINK_ld_ptr_inc16(uint8_t *data, uint16_t words);
 bool LINK_st_ptr(uint16_t address);
 bool LINK_st_ptr_inc(uint8_t *data, uint16_t len);
 bool LINK_st_ptr_inc16(uint8_t *data, uint16_t len);
+bool LINK_Read_SIB(uint8_t *data);
 
 #endif
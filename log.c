@@ -1,8 +1,217 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include "log.h"
+#include "session.h"
+#include "stats.h"
 
-static uint8_t LOG_Level = LOG_LEVEL_ERROR;
+typedef struct
+{
+  atomic_uint seq;        // ring position the record is ready for
+  uint64_t  time;
+  uint8_t   level;
+  uint16_t  len;
+  char      text[LOG_RECORD_LEN];
+} tLogRecord;
+
+static const char *LOG_Prefix[] = {"INFO: ", "WARNING: ", "ERROR: "};
+
+/**< ring buffer shared by all sessions, many writers and the flusher as the only reader */
+static tLogRecord LOG_Ring[LOG_RING_SIZE];
+static atomic_uint LOG_Head;
+static unsigned LOG_Tail;
+static atomic_uint LOG_Dropped;
+static atomic_bool LOG_Running;
+static atomic_bool LOG_Idle;          // flusher waits for LOG_Wake
+static pthread_mutex_t LOG_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t LOG_Wake = PTHREAD_COND_INITIALIZER;
+static FILE *LOG_Output = NULL;
+static bool LOG_Binary;
+static uint64_t LOG_Start_Time;
+static pthread_t LOG_Thread;
+
+/** \brief Put formatted message into the ring, it is dropped if the ring is full
+ *
+ * \param [in] level Log level for the message
+ * \param [in] msg Message text
+ * \param [in] args Message parameters
+ * \return Nothing
+ *
+ */
+static void LOG_Push(uint8_t level, char *msg, va_list args)
+{
+  tLogRecord *record;
+  unsigned pos = atomic_load_explicit(&LOG_Head, memory_order_relaxed);
+  int diff;
+  int len;
+
+  while (true)
+  {
+    record = &LOG_Ring[pos & (LOG_RING_SIZE - 1)];
+    diff = (int)(atomic_load_explicit(&record->seq, memory_order_acquire) - pos);
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&LOG_Head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else
+    if (diff < 0)
+    {
+      atomic_fetch_add_explicit(&LOG_Dropped, 1, memory_order_relaxed);
+      return;
+    } else
+      pos = atomic_load_explicit(&LOG_Head, memory_order_relaxed);
+  }
+  record->time = STATS_GetTime();
+  record->level = level;
+  len = vsnprintf(record->text, LOG_RECORD_LEN, msg, args);
+  record->len = (len < 0) ? 0 : ((len >= LOG_RECORD_LEN) ? LOG_RECORD_LEN - 1 : len);
+  atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+  // the lock is taken only if the flusher sleeps
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&LOG_Idle) == true)
+  {
+    pthread_mutex_lock(&LOG_Mutex);
+    pthread_cond_signal(&LOG_Wake);
+    pthread_mutex_unlock(&LOG_Mutex);
+  }
+}
+
+/** \brief Write one record to the log output
+ *
+ * \param [in] record Log record
+ * \return Nothing
+ *
+ */
+static void LOG_Write(tLogRecord *record)
+{
+  uint64_t time = record->time - LOG_Start_Time;
+  uint8_t header[11];
+  uint8_t i;
+
+  if (LOG_Binary == true)
+  {
+    // little endian time in microseconds, level, length and text
+    for (i = 0; i < 8; i++)
+      header[i] = (time >> (8 * i)) & 0xFF;
+    header[8] = record->level;
+    header[9] = record->len & 0xFF;
+    header[10] = record->len >> 8;
+    fwrite(header, 1, sizeof(header), LOG_Output);
+    fwrite(record->text, 1, record->len, LOG_Output);
+  } else
+  if (LOG_Output == stdout)
+    fprintf(LOG_Output, "%s%s\n", LOG_Prefix[record->level], record->text);
+  else
+    fprintf(LOG_Output, "%12.6f %s%s\n", time / 1000000.0, LOG_Prefix[record->level], record->text);
+}
+
+/** \brief Flusher thread, writes records until logging is stopped and the ring is empty
+ *
+ * \param [in] arg Not used
+ * \return NULL
+ *
+ */
+static void *LOG_Flusher(void *arg)
+{
+  tLogRecord *record;
+  struct timespec until;
+  unsigned dropped;
+  bool running;
+
+  (void)arg;
+  while (true)
+  {
+    running = atomic_load(&LOG_Running);
+    record = &LOG_Ring[LOG_Tail & (LOG_RING_SIZE - 1)];
+    if (atomic_load_explicit(&record->seq, memory_order_acquire) == LOG_Tail + 1)
+    {
+      LOG_Write(record);
+      atomic_store_explicit(&record->seq, LOG_Tail + LOG_RING_SIZE, memory_order_release);
+      LOG_Tail++;
+      continue;
+    }
+    if ((dropped = atomic_exchange(&LOG_Dropped, 0)) > 0)
+    {
+      if (LOG_Binary == false)
+        fprintf(LOG_Output, "WARNING: %u log messages dropped\n", dropped);
+    }
+    fflush(LOG_Output);
+    if (running == false)
+      break;
+    // empty ring, sleep until a record is pushed, the timeout covers a missed wakeup
+    pthread_mutex_lock(&LOG_Mutex);
+    atomic_store(&LOG_Idle, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if ((atomic_load_explicit(&record->seq, memory_order_acquire) != LOG_Tail + 1) &&
+        (atomic_load(&LOG_Running) == true))
+    {
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += LOG_IDLE_MS * 1000000L;
+      until.tv_sec += until.tv_nsec / 1000000000L;
+      until.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&LOG_Wake, &LOG_Mutex, &until);
+    }
+    atomic_store(&LOG_Idle, false);
+    pthread_mutex_unlock(&LOG_Mutex);
+  }
+  return NULL;
+}
+
+/** \brief Write log through the ring buffer and a background flusher from now on
+ *
+ * \param [in] fp Log output, stdout or a file
+ * \param [in] binary true for binary records instead of text lines
+ * \return true if succeed
+ *
+ */
+bool LOG_Start(FILE *fp, bool binary)
+{
+  unsigned i;
+
+  if (LOG_Output != NULL)
+    return false;
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    atomic_init(&LOG_Ring[i].seq, i);
+  atomic_init(&LOG_Head, 0);
+  atomic_init(&LOG_Dropped, 0);
+  atomic_init(&LOG_Running, true);
+  atomic_init(&LOG_Idle, false);
+  LOG_Tail = 0;
+  LOG_Binary = binary;
+  LOG_Start_Time = STATS_GetTime();
+  if (binary == true)
+  {
+    fwrite(LOG_BINARY_MAGIC, 1, strlen(LOG_BINARY_MAGIC), fp);
+    fputc(LOG_BINARY_VERSION, fp);
+  }
+  LOG_Output = fp;
+  if (pthread_create(&LOG_Thread, NULL, LOG_Flusher, NULL) != 0)
+  {
+    LOG_Output = NULL;
+    return false;
+  }
+  return true;
+}
+
+/** \brief Flush all queued messages and go back to direct printing
+ *
+ * \return Nothing
+ *
+ */
+void LOG_Stop(void)
+{
+  if (LOG_Output == NULL)
+    return;
+  atomic_store(&LOG_Running, false);
+  pthread_mutex_lock(&LOG_Mutex);
+  pthread_cond_signal(&LOG_Wake);
+  pthread_mutex_unlock(&LOG_Mutex);
+  pthread_join(LOG_Thread, NULL);
+  LOG_Output = NULL;
+}
 
 /** \brief Print log message according level settings
  *
@@ -15,26 +224,22 @@ static uint8_t LOG_Level = LOG_LEVEL_ERROR;
 void LOG_Print(uint8_t level, char *msg, ...)
 {
   va_list args;
+  char text[LOG_LINE_LEN];
 
-  if (level < LOG_Level)
+  if ((level < SESSION_Current->log_level) || (level >= LOG_LEVEL_LAST))
     return;
 
-  switch (level)
+  va_start(args, msg);
+  if (LOG_Output != NULL)
   {
-    case LOG_LEVEL_INFO:
-      printf("INFO: ");
-      break;
-    case LOG_LEVEL_WARNING:
-      printf("WARNING: ");
-      break;
-    case LOG_LEVEL_ERROR:
-      printf("ERROR: ");
-      break;
+    LOG_Push(level, msg, args);
+  } else
+  {
+    // one write per message
+    vsnprintf(text, sizeof(text), msg, args);
+    printf("%s%s\n", LOG_Prefix[level], text);
   }
-  va_start(args, msg);
-  vprintf(msg, args);
   va_end(args);
-  printf("\n");
 }
 
 /** \brief Set log level (INFO/WARNING/ERROR)
@@ -47,5 +252,5 @@ void LOG_SetLevel(uint8_t level)
 {
   if (level >= LOG_LEVEL_LAST)
     return;
-  LOG_Level = level;
+  SESSION_Current->log_level = level;
 }
@@ -2,13 +2,32 @@
 #define LOG_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "libupdi.h"
 
-enum {
-  LOG_LEVEL_INFO,
-  LOG_LEVEL_WARNING,
-  LOG_LEVEL_ERROR,
-  LOG_LEVEL_LAST
-};
+/**< messages below this level are removed at compile time where LOG_INFO() is used,
+     0 keeps all of them, 1 drops INFO */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL       0
+#endif
+
+#define LOG_RING_SIZE       (256)   // power of 2
+#define LOG_RECORD_LEN      (120)
+#define LOG_LINE_LEN        (256)
+#define LOG_IDLE_MS         (100)   // longest sleep of the flusher with an empty ring
+#define LOG_BINARY_MAGIC    "UPDILOG"
+#define LOG_BINARY_VERSION  (1)
+
+/**< Binary log is the magic with version byte followed by records:
+     64-bit time in microseconds, level byte, 16-bit length and the text,
+     all little endian */
+
+#if LOG_MIN_LEVEL > 0
+#define LOG_INFO(...)       do {} while (0)
+#else
+#define LOG_INFO(...)       LOG_Print(LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
 
 void LOG_Print(uint8_t level, char *msg, ...);
 void LOG_SetLevel(uint8_t level);
@@ -3,6 +3,7 @@
 // TODO (A.K.#1#): Add Doxygen comments
 // TODO (A.K.#1#): Read device info
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,38 +11,45 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <unistd.h>
-#include "devices.h"
-#include "link.h"
-#include "log.h"
-#include "nvm.h"
-#include "phy.h"
+#include "daemon.h"
+#include "libupdi.h"
 
-#define FILENAME_LEN    (64)
 #define COMPORT_LEN     (32)
 #define FUSES_LEN       (128)
 
+#define LOOP_POLL_MS    (100)
+#define LOOP_DEBOUNCE   (3)
+
 #define SW_VER_NUMBER   "0.7"
 #define SW_VER_DATE     "09.03.2022"
 
 typedef struct
 {
-  bool      erase;
-  bool      write;
-  bool      read;
-  bool      wr_fuses;
-  bool      rd_fuses;
-  bool      lock;
-  bool      unlock;
   bool      show_info;
+  bool      loop;
+  bool      stats;
   uint32_t  baudrate;
   int8_t    device;
+  char      *device_name;
+  char      *device_db;
   char      port[COMPORT_LEN];
-  char      wr_file[FILENAME_LEN];
-  char      rd_file[FILENAME_LEN];
   char      fuses[FUSES_LEN];
+  char      daemon[DAEMON_PATH_LEN];
+  char      *capture;
+  char      *decode;
+  char      *replay;
+  char      *log;
+  char      *checkpoint;
+  char      *nvm_profile;
+  bool      log_async;
+  bool      log_binary;
+  float     replay_scale;
+  tPlan     plan;
 } tParam;
 
 tParam parameters;
+tSession *session;
+volatile sig_atomic_t interrupted = 0;
 
 /** \brief Print help screen with list of commands
  *
@@ -53,7 +61,7 @@ void help(void)
   uint8_t i;
 
   printf("  -b BAUDRATE - set COM baudrate (default=115200)\n");
-  printf("  -d DEVICE   - target device (tinyXXX)\n");
+  printf("  -d DEVICE   - target device (tinyXXX), auto to detect it from the signature\n");
   printf("  -c COM_PORT - COM port to use (Win: COMx | *nix: /dev/ttyX)\n");
   printf("  -e          - erase device\n");
   printf("  -fw X:0xYY  - write fuses (X - fuse number, 0xYY - hex value)\n");
@@ -62,9 +70,35 @@ void help(void)
   printf("  -lr         - unlock device\n");
   printf("  -h          - show this help screen\n");
   printf("  -mX         - set logging level (0-all/1-warnings/2-errors)\n");
-  printf("  -r FILE.HEX - Hex file to read MCU flash into\n");
+  printf("  -o OFFSET   - load offset for binary files (default=0)\n");
+  printf("  -r FILE     - file to read MCU flash into (.hex/.srec/.bin)\n");
   //printf("  -p          - use DTR line to power device\n");
-  printf("  -w FILE.HEX - Hex file to write to MCU flash\n");
+  printf("  -p FILE     - plan file with operations, one per line\n");
+  printf("  -w FILE     - file to write to MCU flash (HEX/S-record/binary)\n");
+  printf("  --verify    - verify flash after writing\n");
+  printf("  --verify-only FILE - compare flash with file, stop at first mismatch\n");
+  printf("  --verify-crc - verify with on-chip CRCSCAN if the image carries a CRC\n");
+  printf("  --blank-check - check if flash and EEPROM are erased\n");
+  printf("  --auto-erase - erase before writing only if the target area is not blank\n");
+  printf("  --app-only  - erase and write application code section only, bootloader and app data are kept\n");
+  printf("  --eeprom-write FILE  - write EEPROM, only changed bytes are written\n");
+  printf("  --eeprom-read FILE   - read EEPROM to file\n");
+  printf("  --eeprom-verify FILE - compare EEPROM with file\n");
+  printf("  --userrow-write FILE - write user row, works on locked devices too\n");
+  printf("  --userrow-read FILE  - read user row to file\n");
+  printf("  --daemon SOCKET - serve programming jobs on a Unix domain socket\n");
+  printf("  --loop      - program targets one after another as they are seated\n");
+  printf("  --stats json - print timing and link statistics of the run as JSON\n");
+  printf("  --capture FILE - record all port traffic with timestamps to FILE\n");
+  printf("  --decode FILE  - print recorded trace as UPDI instructions and exit\n");
+  printf("  --replay FILE  - answer from recorded trace instead of the port\n");
+  printf("  --replay-speed X - replay timing scale, 0 (default) for no delays, 1 for recorded timing\n");
+  printf("  --device-db FILE - load device definitions, they replace built-in ones with the same name\n");
+  printf("  --checkpoint FILE - keep progress of an interrupted flash write in FILE and resume it\n");
+  printf("  --nvm-profile FILE - learn NVM write and erase times in FILE, status polls are scheduled from them\n");
+  printf("  --log-async - write log from a background thread, hot path only queues messages\n");
+  printf("  --log-file FILE - write log with timestamps to FILE, implies --log-async\n");
+  printf("  --log-binary FILE - write log as binary records to FILE, implies --log-async\n");
   printf("\n");
   printf("  List of supported devices:\n    ");
   for (i = 1; i < DEVICES_GetNumber()+1; i++)
@@ -78,6 +112,95 @@ void help(void)
   printf("\n");
 }
 
+/** \brief Stop the loop mode on Ctrl+C
+ *
+ * \param [in] sig Signal number
+ * \return Nothing
+ *
+ */
+void on_interrupt(int sig)
+{
+  (void)sig;
+  interrupted = 1;
+}
+
+/** \brief Open image file, loop mode keeps images parsed in the cache
+ *
+ * \param [in] name File name
+ * \return stream handle, NULL on error
+ *
+ */
+FILE *open_image(char *name)
+{
+  return fopen(name, "rb");
+}
+
+/** \brief Wait until the target is seated or removed
+ *
+ * \param [in] present Target state to wait for
+ * \return true if the state is reached, false if interrupted
+ *
+ */
+bool wait_target(bool present)
+{
+  uint8_t count = 0;
+
+  while (interrupted == 0)
+  {
+    // several probes in a row to get over contact bouncing
+    if (SESSION_Probe(session) == present)
+    {
+      if (++count >= LOOP_DEBOUNCE)
+        return true;
+    } else
+    {
+      count = 0;
+    }
+    usleep(LOOP_POLL_MS * 1000);
+  }
+  return false;
+}
+
+/** \brief Run the plan on targets one after another until interrupted
+ *
+ * \return number of failed targets
+ *
+ */
+uint16_t loop(void)
+{
+  uint16_t passed = 0;
+  uint16_t failed = 0;
+
+  signal(SIGINT, on_interrupt);
+  while (interrupted == 0)
+  {
+    printf("Waiting for target...\n");
+    if (wait_target(true) == false)
+      break;
+    printf("Target #%d found\n", passed + failed + 1);
+    SESSION_ResetStats(session);
+    if (SESSION_Execute(session, &parameters.plan) == true)
+    {
+      printf("RESULT PASS\n");
+      passed++;
+      if (parameters.stats == true)
+        SESSION_PrintStats(session, stdout, true);
+    } else
+    {
+      printf("RESULT FAIL\n");
+      failed++;
+      if (parameters.stats == true)
+        SESSION_PrintStats(session, stdout, false);
+    }
+    printf("Passed: %d, failed: %d, remove the target\n", passed, failed);
+    if (wait_target(false) == false)
+      break;
+  }
+  printf("\nTotal passed: %d, failed: %d\n", passed, failed);
+
+  return failed;
+}
+
 /** \brief Main application function
  *
  * \param [in] argc Number of command line arguments
@@ -88,11 +211,13 @@ void help(void)
 int main(int argc, char* argv[])
 {
   uint8_t i;
-  uint8_t x;
+  uint8_t op;
+  uint8_t memory;
   bool error;
   uint32_t tVal;
   char *pch;
-  uint16_t val;
+  FILE *log;
+  int res = 0;
   //int ccc;
 
   printf("################################################################\n");
@@ -107,8 +232,9 @@ int main(int argc, char* argv[])
   }
 
   memset(&parameters, 0, sizeof(tParam));
-  parameters.baudrate = PHY_BAUDRATE;
+  parameters.baudrate = SESSION_BAUDRATE;
   parameters.device = -1;
+  PLAN_Init(&parameters.plan);
 
   i = 1;
   error = false;
@@ -118,6 +244,202 @@ int main(int argc, char* argv[])
     {
       switch (argv[i][1])
       {
+        case '-':
+          /**< long options */
+          if (strcmp(argv[i], "--verify") == 0)
+          {
+            parameters.plan.verify = true;
+          } else
+          if (strcmp(argv[i], "--verify-crc") == 0)
+          {
+            parameters.plan.verify_crc = true;
+          } else
+          if (strcmp(argv[i], "--blank-check") == 0)
+          {
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_BLANK_CHECK, PLAN_MEM_FLASH, NULL) ||
+                    !PLAN_AddStep(&parameters.plan, PLAN_OP_BLANK_CHECK, PLAN_MEM_EEPROM, NULL);
+          } else
+          if (strcmp(argv[i], "--auto-erase") == 0)
+          {
+            parameters.plan.auto_erase = true;
+          } else
+          if (strcmp(argv[i], "--app-only") == 0)
+          {
+            parameters.plan.app_only = true;
+          } else
+          if (strcmp(argv[i], "--stats") == 0)
+          {
+            if ((i < (argc - 1)) && (strcmp(argv[i + 1], "json") == 0))
+            {
+              parameters.stats = true;
+              i++;
+            } else
+            {
+              printf("%s: only json format is supported!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if ((strcmp(argv[i], "--capture") == 0) || (strcmp(argv[i], "--decode") == 0))
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              if (strcmp(argv[i], "--capture") == 0)
+                parameters.capture = argv[i + 1];
+              else
+                parameters.decode = argv[i + 1];
+              i++;
+            } else
+            {
+              printf("%s: wrong trace file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--replay") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              parameters.replay = argv[i + 1];
+              i++;
+            } else
+            {
+              printf("%s: wrong trace file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--replay-speed") == 0)
+          {
+            if ((i < (argc - 1)) && (sscanf(argv[i + 1], "%f", &parameters.replay_scale) == 1) &&
+                (parameters.replay_scale >= 0))
+            {
+              i++;
+            } else
+            {
+              printf("%s: wrong timing scale!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--device-db") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              parameters.device_db = argv[i + 1];
+              i++;
+            } else
+            {
+              printf("%s: wrong device database file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--checkpoint") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              parameters.checkpoint = argv[i + 1];
+              i++;
+            } else
+            {
+              printf("%s: wrong checkpoint file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--nvm-profile") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              parameters.nvm_profile = argv[i + 1];
+              i++;
+            } else
+            {
+              printf("%s: wrong NVM profile file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--log-async") == 0)
+          {
+            parameters.log_async = true;
+          } else
+          if ((strcmp(argv[i], "--log-file") == 0) || (strcmp(argv[i], "--log-binary") == 0))
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              parameters.log = argv[i + 1];
+              parameters.log_async = true;
+              parameters.log_binary = (strcmp(argv[i], "--log-binary") == 0);
+              i++;
+            } else
+            {
+              printf("%s: wrong log file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if (strcmp(argv[i], "--loop") == 0)
+          {
+            parameters.loop = true;
+          } else
+          if (strcmp(argv[i], "--daemon") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-') && (strlen(argv[i + 1]) < DAEMON_PATH_LEN))
+            {
+              strcpy(parameters.daemon, argv[i + 1]);
+              i++;
+            } else
+            {
+              printf("%s: wrong socket name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          if ((strcmp(argv[i], "--verify-only") == 0) || (strncmp(argv[i], "--eeprom-", 9) == 0) ||
+              (strncmp(argv[i], "--userrow-", 10) == 0))
+          {
+            if (strcmp(argv[i], "--verify-only") == 0)
+            {
+              op = PLAN_OP_VERIFY;
+              memory = PLAN_MEM_FLASH;
+            } else
+            if (strcmp(argv[i], "--eeprom-write") == 0)
+            {
+              op = PLAN_OP_WRITE;
+              memory = PLAN_MEM_EEPROM;
+            } else
+            if (strcmp(argv[i], "--eeprom-read") == 0)
+            {
+              op = PLAN_OP_READ;
+              memory = PLAN_MEM_EEPROM;
+            } else
+            if (strcmp(argv[i], "--eeprom-verify") == 0)
+            {
+              op = PLAN_OP_VERIFY;
+              memory = PLAN_MEM_EEPROM;
+            } else
+            if (strcmp(argv[i], "--userrow-write") == 0)
+            {
+              op = PLAN_OP_WRITE;
+              memory = PLAN_MEM_USERROW;
+            } else
+            if (strcmp(argv[i], "--userrow-read") == 0)
+            {
+              op = PLAN_OP_READ;
+              memory = PLAN_MEM_USERROW;
+            } else
+            {
+              printf("Unknown parameter: %s\n", argv[i]);
+              error = true;
+              break;
+            }
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              error = !PLAN_AddStep(&parameters.plan, op, memory, argv[i + 1]);
+              i++;
+            } else
+            {
+              printf("%s: wrong file name!\n", argv[i]);
+              error = true;
+            }
+          } else
+          {
+            printf("Unknown parameter: %s\n", argv[i]);
+          }
+          break;
         case 'b':
           /**< set communication baudrate */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
@@ -140,26 +462,19 @@ int main(int argc, char* argv[])
           }
           break;
         case 'd':
-          /**< set device id */
+          /**< set device id, it is looked up after the device database is loaded */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
-          {
-            parameters.device = DEVICES_GetId(argv[i + 1]);
-            if (parameters.device < 0)
-            {
-              printf("Wrong or unsupported device type: %s\n", argv[i + 1]);
-              error = true;
-            }
-          }
+            parameters.device_name = argv[i + 1];
           break;
         case 'e':
           /**< erase memory */
-          parameters.erase = true;
+          error = !PLAN_AddStep(&parameters.plan, PLAN_OP_ERASE, PLAN_MEM_NONE, NULL);
           break;
         case 'f':
           /**< fuses: read or write */
           if (argv[i][2] == 'r')
           {
-            parameters.rd_fuses = true;
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_FUSES_READ, PLAN_MEM_NONE, NULL);
           } else
           if (argv[i][2] == 'w')
           {
@@ -184,7 +499,7 @@ int main(int argc, char* argv[])
               error = true;
             } else
             {
-              parameters.wr_fuses = true;
+              error = !PLAN_AddStep(&parameters.plan, PLAN_OP_FUSES_WRITE, PLAN_MEM_NONE, parameters.fuses);
             }
           } else
           {
@@ -200,13 +515,23 @@ int main(int argc, char* argv[])
           /**< show device info */
           parameters.show_info = true;
           break;
+        case 'p':
+          /**< load plan file */
+          if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+          {
+            error = !PLAN_LoadFile(&parameters.plan, argv[i + 1]);
+            i++;
+          } else
+          {
+            printf("%s: wrong plan file name!\n", argv[i]);
+            error = true;
+          }
+          break;
         case 'r':
-          /**< read from flash to HEX file */
+          /**< read from flash to image file */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
           {
-            strncpy(parameters.rd_file, argv[i + 1], FILENAME_LEN);
-            parameters.rd_file[FILENAME_LEN - 1] = 0;
-            parameters.read = true;
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_READ, PLAN_MEM_FLASH, argv[i + 1]);
             i++;
           } else
           {
@@ -218,11 +543,11 @@ int main(int argc, char* argv[])
           /**< lock/unlock device */
           if (argv[i][2] == 's')
           {
-            parameters.lock = true;
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_LOCK, PLAN_MEM_NONE, NULL);
           } else
           if (argv[i][2] == 'r')
           {
-            parameters.unlock = true;
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_UNLOCK, PLAN_MEM_NONE, NULL);
           } else
           {
             printf("%s: wrong or unsupported fuses parameter!\n", argv[i]);
@@ -232,15 +557,33 @@ int main(int argc, char* argv[])
         case 'm':
           /**< level of messaging */
           if (argv[i][2] >= '0' && argv[i][2] <= '2')
-            LOG_SetLevel(argv[i][2] - '0');
+            SESSION_SetLogLevel(NULL, argv[i][2] - '0');
+          break;
+        case 'o':
+          /**< set load offset for binary files */
+          if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+          {
+            tVal = (uint32_t)strtoul(argv[i + 1], &pch, 0);
+            if ((*pch != 0) || (tVal > 0xFFFF))
+            {
+              printf("%s: wrong load offset: %s\n", argv[i], argv[i + 1]);
+              error = true;
+            } else
+            {
+              parameters.plan.offset = (uint16_t)tVal;
+            }
+            i++;
+          } else
+          {
+            printf("%s: load offset is missing!\n", argv[i]);
+            error = true;
+          }
           break;
         case 'w':
-          /**< write to flash from HEX file */
+          /**< write to flash from image file */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
           {
-            strncpy(parameters.wr_file, argv[i + 1], FILENAME_LEN);
-            parameters.wr_file[FILENAME_LEN - 1] = 0;
-            parameters.write = true;
+            error = !PLAN_AddStep(&parameters.plan, PLAN_OP_WRITE, PLAN_MEM_FLASH, argv[i + 1]);
             i++;
           } else
           {
@@ -258,7 +601,57 @@ int main(int argc, char* argv[])
     i++;
   }
 
-  if (parameters.device < 0)
+  if (parameters.decode != NULL)
+    return (CAPTURE_Decode(parameters.decode) == true) ? 0 : -1;
+  if ((parameters.device_db != NULL) && (DEVICES_Load(parameters.device_db) == false))
+    return -1;
+  if (parameters.device_name != NULL)
+  {
+    parameters.device = DEVICES_GetNumberByName(parameters.device_name);
+    if ((parameters.device < 0) && (parameters.device != DEVICE_AUTO_ID))
+    {
+      printf("Wrong or unsupported device type: %s\n", parameters.device_name);
+      return -1;
+    }
+  }
+  if (parameters.log_async == true)
+  {
+    if (parameters.log != NULL)
+      log = fopen(parameters.log, (parameters.log_binary == true) ? "wb" : "w");
+    else
+      log = stdout;
+    if ((log == NULL) || (LOG_Start(log, parameters.log_binary) == false))
+    {
+      printf("Can't start log: %s\n", (parameters.log != NULL) ? parameters.log : "stdout");
+      return -1;
+    }
+    // queued messages are written on every way out
+    atexit(LOG_Stop);
+  }
+  /**< sessions opened later share the trace of the default session */
+  if ((parameters.capture != NULL) && (SESSION_StartCapture(NULL, parameters.capture) == false))
+    return -1;
+  if (parameters.replay != NULL)
+  {
+    if (SESSION_StartReplay(NULL, parameters.replay, parameters.replay_scale) == false)
+      return -1;
+    if (strlen(parameters.port) == 0)
+      strcpy(parameters.port, "replay");
+  }
+  /**< learned timing is copied to the sessions opened later */
+  if (parameters.nvm_profile != NULL)
+    SESSION_LoadTiming(NULL, parameters.nvm_profile);
+  if (strlen(parameters.daemon) > 0)
+  {
+    /**< -c, -b and -d are defaults for the jobs */
+    res = (DAEMON_Run(parameters.daemon, parameters.port, parameters.baudrate, parameters.device) == true) ? 0 : -1;
+    // timing learned by the jobs is handed back when the daemon shuts down
+    if (parameters.nvm_profile != NULL)
+      SESSION_SaveTiming(NULL, parameters.nvm_profile);
+    SESSION_StopCapture(NULL);
+    return res;
+  }
+  if ((parameters.device < 0) && (parameters.device != DEVICE_AUTO_ID))
   {
     printf("Device type (-d) is not set!\n");
     return -1;
@@ -268,107 +661,55 @@ int main(int argc, char* argv[])
     printf("COM port name is missing!\n");
     return -1;
   }
-  if (!parameters.read && !parameters.write && !parameters.erase && !parameters.rd_fuses &&
-      !parameters.wr_fuses && !parameters.unlock)
+  if (parameters.plan.number == 0)
   {
     printf("Nothing to do, stopping\n");
     return -1;
   }
 
-  if (LINK_Init(parameters.port, parameters.baudrate, false) == false)
+  // in loop mode targets come and go, link is brought up for each one
+  session = SESSION_Open(parameters.port, parameters.baudrate, (parameters.device == DEVICE_AUTO_ID) ?
+                         DEVICES_AUTO : DEVICES_GetNameByNumber(parameters.device), !parameters.loop);
+  if (session == NULL)
   {
     printf("Can't open port: %s\nPlease check connection and try again.\n", parameters.port);
     return -1;
   }
+  if (parameters.loop == true)
+    parameters.plan.open = open_image;
 
-  printf("Working with device: %s\n", DEVICES_GetNameByNumber(parameters.device));
+  printf("Working with device: %s\n", (parameters.device == DEVICE_AUTO_ID) ?
+         DEVICES_AUTO : DEVICES_GetNameByNumber(parameters.device));
 
-  if (parameters.unlock == true)
+  /**< all operations run in one programming mode session */
+  PLAN_Optimize(&parameters.plan);
+  if (parameters.plan.number > 1)
   {
-    printf("Unlocking...   ");
-    if (NVM_UnlockDevice() == true)
-    {
-      printf("OK\n");
-    }
-  }
-
-  if (NVM_EnterProgmode() == false)
-  {
-    printf("Can't enter programming mode, exiting\n");
-    return -1;
-  }
-
-  /**< process input parameters */
-  if (parameters.erase == true)
-  {
-    printf("Erasing\n");
-    NVM_ChipErase();
+    printf("Plan:\n");
+    PLAN_Print(&parameters.plan);
   }
-  if (parameters.wr_fuses == true)
+  if (parameters.loop == true)
   {
-    pch = strchr(parameters.fuses, ' ');
-    while (pch != NULL)
-    {
-      pch++;
-      if (sscanf(pch, "%hu:0x%02X", &val, &tVal) != 2)
-      {
-        printf("Wrong fuse settings at: _%.12s...\n", pch);
-      } else
-      {
-        i = (uint8_t)val;
-        x = (uint8_t)tVal;
-        printf("Writing 0x%02X to fuse Nr. %d\n", x, i);
-        NVM_WriteFuse(i, x);
-      }
-      pch = strchr(pch, ' ');
-    }
-  }
-  if (parameters.rd_fuses == true)
+    if (loop() > 0)
+      res = -1;
+  } else
   {
-    printf("Reading fuses:\n");
-    for (i = 0; i < DEVICES_GetFusesNumber(); i++)
-    {
-      x = NVM_ReadFuse(i);
-      printf("  0x%02X: 0x%02X\n", i, x);
-    }
-  }
-  if (parameters.write == true)
-  {
-    printf("Writing from file: %s\n", parameters.wr_file);
-    NVM_LoadIhex(parameters.wr_file, DEVICES_GetFlashStart(), DEVICES_GetFlashLength());
-  }
-  if (parameters.read == true)
-  {
-    char cwd[PATH_MAX];
-    char ch;
-
-    if (getcwd(cwd, sizeof(cwd)) == NULL)
-      cwd[0] = 0;
-    #ifdef __MINGW32__
-    ch = '\\';
-    #endif // __MINGW32__
-    #if defined(__APPLE__) || defined(__linux)
-    ch = '/';
-    #endif // __linux
-    if (strchr(parameters.rd_file, ch) != NULL)
-    {
-      cwd[0] = 0;
-      ch = 0;
-    }
-    printf("Reading to file: %s%c%s\n", cwd, ch, parameters.rd_file);
-    NVM_SaveIhex(parameters.rd_file, DEVICES_GetFlashStart(), DEVICES_GetFlashLength());
-  }
-  if (parameters.lock == true)
-  {
-    printf("Locking MCU...   ");
-    if (NVM_WriteFuse(DEVICE_LOCKBIT_ADDR, 0x00) == true)
-    {
-      printf("OK\n");
-    }
+    if (parameters.checkpoint != NULL)
+      SESSION_LoadCheckpoint(session, parameters.checkpoint);
+    if (SESSION_Execute(session, &parameters.plan) == false)
+      res = -1;
+    if (parameters.checkpoint != NULL)
+      SESSION_SaveCheckpoint(session, parameters.checkpoint);
+    if (parameters.stats == true)
+      SESSION_PrintStats(session, stdout, res == 0);
   }
 
-  NVM_LeaveProgmode();
-  PHY_Close();
+  if (parameters.nvm_profile != NULL)
+    SESSION_SaveTiming(session, parameters.nvm_profile);
+  SESSION_Close(session);
+  SESSION_StopCapture(NULL);
+  if (SESSION_StopReplay(NULL) == false)
+    res = -1;
 
-  return 0;
+  return res;
 }
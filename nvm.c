@@ -1,25 +1,103 @@
 #include <stdlib.h>
 #include <string.h>
 #include "app.h"
+#include "crc.h"
 #include "devices.h"
-#include "ihex.h"
+#include "image.h"
 #include "link.h"
 #include "log.h"
 #include "nvm.h"
 #include "progress.h"
+#include "session.h"
+#include "stats.h"
+#include "timing.h"
 #include "updi.h"
 
-static bool NVM_Progmode = false;
+/** \brief Compare NVM version of the target with the device definition
+ *
+ * \param [in] sib System Information Block as string
+ * \return true, a difference is reported only
+ *
+ */
+static bool NVM_CheckNvmVersion(char *sib)
+{
+  // SIB has e.g. "P:0" at offset 8
+  if ((sib[10] >= '0') && (sib[10] <= '9') && (sib[10] - '0' != DEVICES_GetNvmVersion()))
+    LOG_Print(LOG_LEVEL_WARNING, "Target has NVM version P:%c, %s is defined with P:%d", sib[10], DEVICES_GetName(),
+              DEVICES_GetNvmVersion());
+  return true;
+}
 
-/** \brief Read info about current device
+/** \brief Read info about current device from SIB and signature row,
+ *         select the device type by its signature or check the selected one
  *
- * \return
+ * \param [in] detect true to select the device type, false to check it
+ * \return true if device type is known and matches the target
  *
  */
-bool NVM_GetDeviceInfo(void)
+bool NVM_GetDeviceInfo(bool detect)
 {
+  char sib[UPDI_SIB_LENGTH + 1];
+  uint8_t signature[DEVICES_SIGNATURE_LEN];
+  uint16_t sigrow;
+  int8_t id;
+
   LOG_Print(LOG_LEVEL_INFO, "Reading device info");
-  return true;//self.application.device_info()
+  TIMING_SetSignature(NULL);
+  memset(sib, 0, sizeof(sib));
+  if (LINK_Read_SIB((uint8_t *)sib) == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't read System Information Block");
+    return false;
+  }
+  LOG_Print(LOG_LEVEL_INFO, "Family %.7s, NVM %.3s, OCD %.3s", &sib[0], &sib[8], &sib[11]);
+
+  // signature row can't be read from a locked device
+  if (LINK_ldcs(UPDI_ASI_SYS_STATUS) & (1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS))
+  {
+    if (detect == true)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "%.7s device is locked, its type can't be detected, set it with -d", &sib[0]);
+      return false;
+    }
+    LOG_Print(LOG_LEVEL_WARNING, "Device is locked, its type is not checked");
+    return true;
+  }
+  // all UPDI parts have the signature row at the same address
+  sigrow = (SESSION_Current->device_id < 0) ? DEVICES_List[0].sigrow_address : DEVICES_GetSigrowAddress();
+  if (APP_ReadData(sigrow, signature, sizeof(signature)) == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't read signature");
+    return false;
+  }
+  // NVM timing is learned per part, parts of one device type may differ
+  TIMING_SetSignature(signature);
+  // the set device may share the signature with a more specific one
+  if ((detect == false) && (DEVICES_HasSignature(signature) == true))
+    return NVM_CheckNvmVersion(sib);
+  id = DEVICES_GetIdBySignature(signature);
+  if (id < 0)
+  {
+    if (detect == true)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unknown device signature %02X %02X %02X", signature[0], signature[1],
+                signature[2]);
+      return false;
+    }
+    LOG_Print(LOG_LEVEL_WARNING, "Unknown device signature %02X %02X %02X, device type is not checked",
+              signature[0], signature[1], signature[2]);
+    return true;
+  }
+  if (detect == true)
+  {
+    DEVICES_SetId(id);
+    LOG_Print(LOG_LEVEL_WARNING, "Detected device: %s (signature %02X %02X %02X)", DEVICES_GetName(), signature[0],
+              signature[1], signature[2]);
+    return NVM_CheckNvmVersion(sib);
+  }
+  LOG_Print(LOG_LEVEL_ERROR, "Device type mismatch: %s is set, target is %s (signature %02X %02X %02X)",
+            DEVICES_GetName(), DEVICES_GetNameByNumber(id), signature[0], signature[1], signature[2]);
+  return false;
 }
 
 /** \brief Enter programming mode
@@ -30,8 +108,8 @@ bool NVM_GetDeviceInfo(void)
 bool NVM_EnterProgmode(void)
 {
   LOG_Print(LOG_LEVEL_INFO, "Entering NVM programming mode");
-  NVM_Progmode = APP_EnterProgmode();
-  return NVM_Progmode;
+  SESSION_Current->progmode = APP_EnterProgmode();
+  return SESSION_Current->progmode;
 }
 
 /** \brief Leave programming mode
@@ -43,7 +121,7 @@ void NVM_LeaveProgmode(void)
 {
   LOG_Print(LOG_LEVEL_INFO, "Leaving NVM programming mode");
   APP_LeaveProgmode();
-  NVM_Progmode = false;
+  SESSION_Current->progmode = false;
 }
 
 /** \brief Unlock and erase a device
@@ -53,7 +131,7 @@ void NVM_LeaveProgmode(void)
  */
 bool NVM_UnlockDevice(void)
 {
-  if (NVM_Progmode == true)
+  if (SESSION_Current->progmode == true)
   {
     LOG_Print(LOG_LEVEL_WARNING, "Device already unlocked");
   } else
@@ -61,7 +139,7 @@ bool NVM_UnlockDevice(void)
     // Unlock after using the NVM key results in prog mode.
     if (APP_Unlock() == true)
     {
-      NVM_Progmode = true;
+      SESSION_Current->progmode = true;
     } else
     {
       return false;
@@ -77,7 +155,7 @@ bool NVM_UnlockDevice(void)
  */
 bool NVM_ChipErase(void)
 {
-  if (NVM_Progmode == false)
+  if (SESSION_Current->progmode == false)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
     return false;
@@ -86,50 +164,114 @@ bool NVM_ChipErase(void)
   return APP_ChipErase();
 }
 
-/** \brief Read data from flash memory
+/** \brief Read memory in bursts of NVM_BURST_SIZE bytes
  *
  * \param [in] address Starting address
  * \param [out] data Buffer to write data
  * \param [in] size Length of data to read
+ * \param [in] prefix Prefix text for the progress bar
  * \return true if succeed
  *
  */
-bool NVM_ReadFlash(uint16_t address, uint8_t *data, uint16_t size)
+static bool NVM_ReadMemory(uint16_t address, uint8_t *data, uint16_t size, char *prefix)
 {
-  uint16_t i;
-  uint16_t pages;
-  uint8_t page_size;
+  uint16_t done;
+  uint16_t len;
   uint8_t err_counter;
 
+  PROGRESS_Print(0, size, prefix, '#');
+  done = 0;
+
+  err_counter = 0;
+  while (done < size)
+  {
+    len = size - done;
+    if (len > NVM_BURST_SIZE)
+      len = NVM_BURST_SIZE;
+    if (APP_ReadData(address + done, &data[done], len) == false)
+    {
+      // error occurred, try once more
+      err_counter++;
+      STATS_AddRetry();
+      if (err_counter > NVM_MAX_ERRORS)
+      {
+        PROGRESS_Break();
+        return false;
+      }
+      continue;
+    } else
+    {
+      err_counter = 0;
+    }
+    done += len;
+    STATS_AddBytes(len);
+    // show progress bar
+    PROGRESS_Print(done, size, prefix, '#');
+  }
+
+  return true;
+}
+
+/** \brief Read data from flash memory
+ *
+ * \param [in] address Starting address
+ * \param [out] data Buffer to write data
+ * \param [in] size Length of data to read
+ * \return true if succeed
+ *
+ */
+bool NVM_ReadFlash(uint16_t address, uint8_t *data, uint16_t size)
+{
   // Must be in prog mode here
-  if (NVM_Progmode == false)
+  if (SESSION_Current->progmode == false)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
     return false;
   }
 
-  page_size = DEVICES_GetPageSize();
+  return NVM_ReadMemory(address, data, size, "Reading: ");
+}
 
-  // Find the number of pages
-  pages = size / page_size;
-  if (size % page_size != 0)
-    pages++;
+/** \brief Compare memory with data buffer in bursts, stop at the first mismatch
+ *
+ * \param [in] address Starting address
+ * \param [in] data Expected data, NULL to compare with erased state (0xFF)
+ * \param [in] size Length of data to compare
+ * \param [out] fail_addr Address of the first mismatch
+ * \param [in] prefix Prefix text for the progress bar
+ * \return true if memory content is equal to the data
+ *
+ */
+static bool NVM_CompareMemory(uint16_t address, uint8_t *data, uint16_t size, uint16_t *fail_addr, char *prefix)
+{
+  uint8_t buf[NVM_BURST_SIZE];
+  uint8_t blank[NVM_BURST_SIZE];
+  uint8_t *expected;
+  uint16_t done;
+  uint16_t len;
+  uint16_t i;
+  uint8_t err_counter;
 
-  PROGRESS_Print(0, pages, "Reading: ", '#');
-  i = 0;
+  *fail_addr = address;
+  memset(blank, 0xff, sizeof(blank));
+
+  PROGRESS_Print(0, size, prefix, '#');
+  done = 0;
 
   err_counter = 0;
-  // Read out page-wise for convenience
-  while (i < pages)
+  while (done < size)
   {
-    LOG_Print(LOG_LEVEL_INFO, "Reading page at 0x%04X", address);
-    if (APP_ReadDataWords(address, &data[i * page_size], DEVICES_GetPageSize() >> 1) == false)
+    len = size - done;
+    if (len > NVM_BURST_SIZE)
+      len = NVM_BURST_SIZE;
+    if (APP_ReadData(address + done, buf, len) == false)
     {
-      // error occurred, try once more
       err_counter++;
+      STATS_AddRetry();
       if (err_counter > NVM_MAX_ERRORS)
       {
         PROGRESS_Break();
+        *fail_addr = address + done;
         return false;
       }
       continue;
@@ -137,16 +279,243 @@ bool NVM_ReadFlash(uint16_t address, uint8_t *data, uint16_t size)
     {
       err_counter = 0;
     }
-    i++;
-    // show progress bar
-    PROGRESS_Print(i, pages, "Reading: ", '#');
-    address += page_size;
+    // compare on the fly, no need to read the rest after a mismatch
+    expected = (data == NULL) ? blank : &data[done];
+    if (memcmp(buf, expected, len) != 0)
+    {
+      for (i = 0; buf[i] == expected[i]; i++);
+      PROGRESS_Break();
+      *fail_addr = address + done + i;
+      LOG_Print(LOG_LEVEL_INFO, "Mismatch at 0x%04X: 0x%02X instead of 0x%02X", *fail_addr, buf[i], expected[i]);
+      return false;
+    }
+    done += len;
+    STATS_AddBytes(len);
+    PROGRESS_Print(done, size, prefix, '#');
+  }
+
+  return true;
+}
+
+/** \brief Compare flash memory with data buffer, stop at the first mismatch
+ *
+ * \param [in] address Starting address
+ * \param [in] data Expected data
+ * \param [in] size Length of data to compare
+ * \param [out] fail_addr Address of the first mismatch
+ * \return true if memory content is equal to the data
+ *
+ */
+bool NVM_VerifyFlash(uint16_t address, uint8_t *data, uint16_t size, uint16_t *fail_addr)
+{
+  *fail_addr = address;
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  return NVM_CompareMemory(address, data, size, fail_addr, "Verifying: ");
+}
+
+/** \brief Check that memory is erased, stop at the first programmed byte
+ *
+ * \param [in] address Starting address
+ * \param [in] size Length of memory to check
+ * \param [out] fail_addr Address of the first programmed byte
+ * \return true if memory is blank
+ *
+ */
+bool NVM_BlankCheck(uint16_t address, uint16_t size, uint16_t *fail_addr)
+{
+  *fail_addr = address;
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  return NVM_CompareMemory(address, NULL, size, fail_addr, "Blank check: ");
+}
+
+/** \brief Calculate FNV-1a hash of a flash write
+ *
+ * \param [in] address Address to start writing
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \return hash as uint32_t
+ *
+ */
+static uint32_t NVM_Hash(uint16_t address, uint8_t *data, uint16_t size)
+{
+  uint32_t hash = 2166136261u;
+  uint16_t i;
+
+  hash = (hash ^ (address & 0xFF)) * 16777619u;
+  hash = (hash ^ (address >> 8)) * 16777619u;
+  hash = (hash ^ (size & 0xFF)) * 16777619u;
+  hash = (hash ^ (size >> 8)) * 16777619u;
+  hash = (hash ^ (uint8_t)SESSION_Current->device_id) * 16777619u;
+  for (i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+/** \brief Read serial number of the target, all zero if it can't be read
+ *
+ * \param [out] serial Serial number buffer of NVM_SERIAL_LEN bytes
+ * \return Nothing
+ *
+ */
+static void NVM_ReadSerial(uint8_t *serial)
+{
+  if (APP_ReadData(DEVICES_GetSigrowAddress() + NVM_SERIAL_OFFSET, serial, NVM_SERIAL_LEN) == false)
+    memset(serial, 0, NVM_SERIAL_LEN);
+}
+
+/** \brief Check if the checkpoint belongs to this write on this very part
+ *
+ * \param [in] address Address to start writing
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \return true if the write can be resumed
+ *
+ */
+bool NVM_CheckpointMatches(uint16_t address, uint8_t *data, uint16_t size)
+{
+  tNvmCheckpoint *checkpoint = &SESSION_Current->checkpoint;
+  uint8_t serial[NVM_SERIAL_LEN];
+
+  if ((checkpoint->committed == 0) || (checkpoint->address != address) ||
+      (checkpoint->hash != NVM_Hash(address, data, size)))
+    return false;
+  // another board of the same type must start from scratch
+  NVM_ReadSerial(serial);
+  return (memcmp(serial, checkpoint->serial, NVM_SERIAL_LEN) == 0);
+}
+
+/** \brief Forget the interrupted write
+ *
+ * \return Nothing
+ *
+ */
+void NVM_ClearCheckpoint(void)
+{
+  SESSION_Current->checkpoint.committed = 0;
+}
+
+/** \brief Load checkpoint of an interrupted write from file
+ *
+ * \param [in] filename Checkpoint file name
+ * \return true if a checkpoint was loaded
+ *
+ */
+bool NVM_LoadCheckpoint(char *filename)
+{
+  tNvmCheckpoint *checkpoint = &SESSION_Current->checkpoint;
+  unsigned int hash, address, committed, byte;
+  char serial[2 * NVM_SERIAL_LEN + 1];
+  FILE *fp;
+  uint8_t i;
+  bool res;
+
+  NVM_ClearCheckpoint();
+  if ((fp = fopen(filename, "r")) == NULL)
+    return false;
+  res = (fscanf(fp, "updiprog-checkpoint %x %x %x %20s", &hash, &address, &committed, serial) == 4) &&
+        (strlen(serial) == 2 * NVM_SERIAL_LEN);
+  fclose(fp);
+  if (res == false)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Wrong checkpoint file: %s", filename);
+    return false;
   }
+  for (i = 0; i < NVM_SERIAL_LEN; i++)
+  {
+    sscanf(&serial[2 * i], "%2x", &byte);
+    checkpoint->serial[i] = (uint8_t)byte;
+  }
+  checkpoint->hash = hash;
+  checkpoint->address = (uint16_t)address;
+  checkpoint->committed = (uint16_t)committed;
+  return true;
+}
+
+/** \brief Save checkpoint of an interrupted write, the file is removed if there is none
+ *
+ * \param [in] filename Checkpoint file name
+ * \return true if succeed
+ *
+ */
+bool NVM_SaveCheckpoint(char *filename)
+{
+  tNvmCheckpoint *checkpoint = &SESSION_Current->checkpoint;
+  FILE *fp;
+  uint8_t i;
 
+  if (checkpoint->committed == 0)
+  {
+    remove(filename);
+    return true;
+  }
+  if ((fp = fopen(filename, "w")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't save checkpoint: %s", filename);
+    return false;
+  }
+  fprintf(fp, "updiprog-checkpoint %08X %04X %04X ", checkpoint->hash, checkpoint->address, checkpoint->committed);
+  for (i = 0; i < NVM_SERIAL_LEN; i++)
+    fprintf(fp, "%02X", checkpoint->serial[i]);
+  fprintf(fp, "\n");
+  fclose(fp);
+  LOG_Print(LOG_LEVEL_WARNING, "Write interrupted at 0x%04X, checkpoint saved to %s",
+            checkpoint->address + checkpoint->committed, filename);
   return true;
 }
 
-/** \brief Write data buffer to flash
+/** \brief Bring up UPDI link and programming mode again after the link died
+ *
+ * \return true if succeed
+ *
+ */
+static bool NVM_Reconnect(void)
+{
+  LOG_Print(LOG_LEVEL_WARNING, "Link lost, reconnecting");
+  if (LINK_Connect(SESSION_Current->port, SESSION_Current->baudrate) == false)
+    return false;
+  return NVM_EnterProgmode();
+}
+
+/** \brief Check if the page holds the data already
+ *
+ * \param [in] address Page address
+ * \param [in] data Page data
+ * \param [in] len Page size
+ * \return true if page content is equal to the data
+ *
+ */
+static bool NVM_PageWritten(uint16_t address, uint8_t *data, uint16_t len)
+{
+  uint8_t buf[NVM_BURST_SIZE];
+  uint16_t done;
+  uint16_t burst;
+
+  // large pages are compared burst by burst, the first difference ends the check
+  for (done = 0; done < len; done += burst)
+  {
+    burst = len - done;
+    if (burst > NVM_BURST_SIZE)
+      burst = NVM_BURST_SIZE;
+    if ((APP_ReadData(address + done, buf, burst) == false) || (memcmp(buf, &data[done], burst) != 0))
+      return false;
+  }
+  return true;
+}
+
+/** \brief Write data buffer to flash, an interrupted write is resumed
+ *         at the first page not committed
  *
  * \param [in] address Address to start writing
  * \param [in] data Data buffer to write
@@ -156,13 +525,17 @@ bool NVM_ReadFlash(uint16_t address, uint8_t *data, uint16_t size)
  */
 bool NVM_WriteFlash(uint16_t address, uint8_t *data, uint16_t size)
 {
-  uint8_t page_size;
+  tNvmCheckpoint *checkpoint = &SESSION_Current->checkpoint;
+  uint16_t page_size;
   uint16_t pages;
+  uint16_t page;
   uint16_t i;
   uint8_t err_counter;
+  uint8_t resumes;
+  bool erase;
 
   // Must be in prog mode
-  if (NVM_Progmode == false)
+  if (SESSION_Current->progmode == false)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
     return false;
@@ -175,34 +548,374 @@ bool NVM_WriteFlash(uint16_t address, uint8_t *data, uint16_t size)
   if (size % page_size != 0)
     pages++;
 
-  PROGRESS_Print(0, pages, "Writing: ", '#');
-  i = 0;
+  if (NVM_CheckpointMatches(address, data, size) == true)
+  {
+    i = checkpoint->committed / page_size;
+    LOG_Print(LOG_LEVEL_WARNING, "Resuming interrupted write at 0x%04X", address + i * page_size);
+  } else
+  {
+    i = 0;
+    checkpoint->hash = NVM_Hash(address, data, size);
+    checkpoint->address = address;
+    checkpoint->committed = 0;
+    NVM_ReadSerial(checkpoint->serial);
+  }
+  // page the write stopped at may be written partly
+  erase = (i > 0);
+  PROGRESS_Print(0, pages * page_size, "Writing: ", '#');
 
   err_counter = 0;
+  resumes = 0;
   // Program each page
   while (i < pages)
   {
-    LOG_Print(LOG_LEVEL_INFO, "Writing page at 0x%04X", address);
-    if (APP_WriteNvm(address, &data[i * page_size], page_size, true) == false)
+    page = address + i * page_size;
+    if ((erase == true) && (NVM_PageWritten(page, &data[i * page_size], page_size) == true))
     {
-      err_counter++;
-      if (err_counter > NVM_MAX_ERRORS)
+      LOG_Print(LOG_LEVEL_INFO, "Page at 0x%04X is written already", page);
+    } else
+    {
+      LOG_Print(LOG_LEVEL_INFO, "Writing page at 0x%04X", page);
+      if (APP_WriteNvm(page, &data[i * page_size], page_size, true, erase) == false)
       {
-        PROGRESS_Break();
-        return false;
+        err_counter++;
+        STATS_AddRetry();
+        if (err_counter > NVM_MAX_ERRORS)
+        {
+          // link is likely gone, bring it up again and redo this page
+          if ((resumes < NVM_MAX_RESUMES) && (NVM_Reconnect() == true))
+          {
+            LOG_Print(LOG_LEVEL_WARNING, "Reconnected, resuming write at 0x%04X", page);
+            resumes++;
+            err_counter = 0;
+            erase = true;
+            continue;
+          }
+          PROGRESS_Break();
+          return false;
+        }
+        continue;
       }
-      continue;
+    }
+    err_counter = 0;
+    erase = false;
+    i++;
+    checkpoint->committed = i * page_size;
+    STATS_AddBytes(page_size);
+    // show progress bar
+    PROGRESS_Print(i * page_size, pages * page_size, "Writing: ", '#');
+  }
+  NVM_ClearCheckpoint();
+
+  return true;
+}
+
+/** \brief Get application code section from BOOTEND and APPEND fuses
+ *
+ * Flash is BOOT, APPCODE and APPDATA sections in this order. APPEND of zero
+ * makes APPCODE reach the flash end, BOOTEND of zero makes the whole flash
+ * BOOT, there is no bootloader to keep then.
+ *
+ * \param [out] start Section start as offset in flash
+ * \param [out] end Section end as offset in flash, not included
+ * \return true if the device has an application code section
+ *
+ */
+bool NVM_GetAppSection(uint16_t *start, uint16_t *end)
+{
+  uint8_t fuses[NVM_FUSE_BOOTEND - NVM_FUSE_APPEND + 1];
+  uint32_t unit;
+  uint32_t flash_size = DEVICES_GetFlashLength();
+
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+  if (DEVICES_GetFusesNumber() <= NVM_FUSE_BOOTEND)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Device has no BOOTEND fuse");
+    return false;
+  }
+  if (APP_ReadData(DEVICES_GetFusesAddress() + NVM_FUSE_APPEND, fuses, sizeof(fuses)) == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Reading section fuses failed");
+    return false;
+  }
+  unit = (DEVICES_GetNvmVersion() < 2) ? NVM_SECTION_UNIT : NVM_SECTION_UNIT_V2;
+  LOG_Print(LOG_LEVEL_INFO, "BOOTEND 0x%02X, APPEND 0x%02X", fuses[1], fuses[0]);
+
+  if (fuses[1] == 0)
+  {
+    *start = 0;
+    *end = (uint16_t)flash_size;
+    return true;
+  }
+  if ((fuses[0] != 0) && (fuses[0] <= fuses[1]))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "APPEND 0x%02X is not above BOOTEND 0x%02X, there is no application code section",
+              fuses[0], fuses[1]);
+    return false;
+  }
+  *start = (uint16_t)((fuses[1] * unit < flash_size) ? fuses[1] * unit : flash_size);
+  *end = (uint16_t)(((fuses[0] != 0) && (fuses[0] * unit < flash_size)) ? fuses[0] * unit : flash_size);
+  return (*start < *end);
+}
+
+/** \brief Erase flash pages one by one, the rest of the flash stays as it is
+ *
+ * \param [in] address Page aligned address to start erasing
+ * \param [in] size Length to erase, multiple of page size
+ * \return true if succeed
+ *
+ */
+bool NVM_ErasePages(uint16_t address, uint16_t size)
+{
+  uint16_t page_size = DEVICES_GetPageSize();
+  uint16_t i;
+
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  PROGRESS_Print(0, size, "Erasing: ", '#');
+  for (i = 0; i < size / page_size; i++)
+  {
+    if (APP_ErasePage(address + i * page_size) == false)
+    {
+      PROGRESS_Break();
+      return false;
+    }
+    PROGRESS_Print((i + 1) * page_size, size, "Erasing: ", '#');
+  }
+  return true;
+}
+
+/** \brief Write flash pages that differ from the data, each one is erased and written
+ *         with one command, so no chip erase is needed
+ *
+ * \param [in] address Page aligned address to start writing
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data, multiple of page size
+ * \param [out] written Number of the pages actually written
+ * \return true if succeed
+ *
+ */
+bool NVM_UpdateFlash(uint16_t address, uint8_t *data, uint16_t size, uint16_t *written)
+{
+  uint16_t page_size = DEVICES_GetPageSize();
+  uint16_t page;
+  uint16_t i;
+  uint8_t err_counter;
+
+  *written = 0;
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  PROGRESS_Print(0, size, "Writing: ", '#');
+  err_counter = 0;
+  i = 0;
+  while (i < size / page_size)
+  {
+    page = address + i * page_size;
+    if (NVM_PageWritten(page, &data[i * page_size], page_size) == true)
+    {
+      LOG_Print(LOG_LEVEL_INFO, "Page at 0x%04X is written already", page);
     } else
     {
-      err_counter = 0;
+      LOG_Print(LOG_LEVEL_INFO, "Writing page at 0x%04X", page);
+      if (APP_WriteNvm(page, &data[i * page_size], page_size, true, true) == false)
+      {
+        STATS_AddRetry();
+        if (++err_counter > NVM_MAX_ERRORS)
+        {
+          PROGRESS_Break();
+          return false;
+        }
+        continue;
+      }
+      (*written)++;
+      STATS_AddBytes(page_size);
     }
+    err_counter = 0;
+    i++;
+    PROGRESS_Print(i * page_size, size, "Writing: ", '#');
+  }
+  return true;
+}
+
+/** \brief Read data from EEPROM
+ *
+ * \param [in] address Starting address
+ * \param [out] data Buffer to write data
+ * \param [in] size Length of data to read
+ * \return true if succeed
+ *
+ */
+bool NVM_ReadEeprom(uint16_t address, uint8_t *data, uint16_t size)
+{
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  return NVM_ReadMemory(address, data, size, "Reading: ");
+}
+
+/** \brief Write data buffer to byte-erasable NVM, only changed bytes are written
+ *
+ * \param [in] address Address to start writing
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \param [in] page_size Size of the NVM page
+ * \param [out] written Number of the bytes actually written
+ * \return true if succeed
+ *
+ */
+static bool NVM_WriteBytes(uint16_t address, uint8_t *data, uint16_t size, uint16_t page_size, uint16_t *written)
+{
+  uint8_t *current;
+  uint16_t pages;
+  uint16_t page_start;
+  uint16_t start;
+  uint16_t end;
+  uint16_t len;
+  uint16_t i;
+  uint16_t n;
+  uint8_t err_counter;
+  bool res = true;
+
+  *written = 0;
+  // Must be in prog mode
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+  if (size == 0)
+    return true;
+
+  current = malloc(size);
+  if (!current)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %d bytes", (int)size);
+    return false;
+  }
+  // Current content is needed to find the changed bytes
+  if (NVM_ReadMemory(address, current, size, "Reading: ") == false)
+  {
+    free(current);
+    return false;
+  }
+
+  page_start = address - (address % page_size);
+  pages = (address + size - page_start + page_size - 1) / page_size;
+
+  PROGRESS_Print(0, pages * page_size, "Writing: ", '#');
+  i = 0;
+
+  err_counter = 0;
+  while (i < pages)
+  {
+    // part of this page covered by data
+    start = page_start + i * page_size;
+    end = start + page_size;
+    if (start < address)
+      start = address;
+    if (end > address + size)
+      end = address + size;
+    len = end - start;
+    if (memcmp(&data[start - address], &current[start - address], len) != 0)
+    {
+      LOG_Print(LOG_LEVEL_INFO, "Writing page at 0x%04X", start);
+      if (APP_WriteNvmDiff(start, &data[start - address], &current[start - address], len) == false)
+      {
+        err_counter++;
+        STATS_AddRetry();
+        if (err_counter > NVM_MAX_ERRORS)
+        {
+          PROGRESS_Break();
+          res = false;
+          break;
+        }
+        continue;
+      }
+      for (n = 0; n < len; n++)
+      {
+        if (data[start - address + n] != current[start - address + n])
+          (*written)++;
+      }
+      STATS_AddBytes(len);
+    }
+    err_counter = 0;
     i++;
     // show progress bar
-    PROGRESS_Print(i, pages, "Writing: ", '#');
-    address += page_size;
+    PROGRESS_Print(i * page_size, pages * page_size, "Writing: ", '#');
   }
+  free(current);
 
-  return true;
+  return res;
+}
+
+/** \brief Write data buffer to EEPROM, only changed bytes are written
+ *
+ * \param [in] address Address to start writing
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \param [out] written Number of the bytes actually written
+ * \return true if succeed
+ *
+ */
+bool NVM_WriteEeprom(uint16_t address, uint8_t *data, uint16_t size, uint16_t *written)
+{
+  return NVM_WriteBytes(address, data, size, DEVICES_GetEepromPageSize(), written);
+}
+
+/** \brief Write user row, only changed bytes are written
+ *
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \param [out] written Number of the bytes actually written
+ * \return true if succeed
+ *
+ */
+bool NVM_WriteUserRow(uint8_t *data, uint16_t size, uint16_t *written)
+{
+  // User row is a single page
+  return NVM_WriteBytes(DEVICES_GetUserrowAddress(), data, size, DEVICES_GetUserrowLength(), written);
+}
+
+/** \brief Write user row of a locked device using the UROWWRITE key
+ *
+ * \param [in] data Data buffer to write
+ * \param [in] size Length of data
+ * \return true if succeed
+ *
+ */
+bool NVM_WriteUserRowLocked(uint8_t *data, uint16_t size)
+{
+  if (SESSION_Current->progmode == true)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Device is not locked, use normal user row writing");
+    return false;
+  }
+  if (size > DEVICES_GetUserrowLength())
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "User row data is too long");
+    return false;
+  }
+
+  return APP_WriteUserRowLocked(DEVICES_GetUserrowAddress(), data, size);
 }
 
 /** \brief Read fuse value
@@ -216,7 +929,7 @@ uint8_t NVM_ReadFuse(uint8_t fusenum)
   uint16_t address;
 
   // Must be in prog mode
-  if (NVM_Progmode == false)
+  if (SESSION_Current->progmode == false)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
     return false;
@@ -227,6 +940,49 @@ uint8_t NVM_ReadFuse(uint8_t fusenum)
   return LINK_ld(address);
 }
 
+/** \brief Read all fuses, lock byte and signature in one go
+ *
+ * \param [out] fuses Snapshot of the fuses
+ * \return true if succeed
+ *
+ */
+bool NVM_ReadFuses(tNvmFuses *fuses)
+{
+  uint8_t buf[NVM_FUSES_MAX];
+  uint8_t len;
+
+  memset(fuses, 0xff, sizeof(tNvmFuses));
+  fuses->number = DEVICES_GetFusesNumber();
+
+  // Must be in prog mode
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return false;
+  }
+
+  // Fuses and lock byte are one block, read it with a single burst
+  len = DEVICE_LOCKBIT_ADDR + 1;
+  if (fuses->number > len)
+    len = fuses->number;
+  if ((len > NVM_FUSES_MAX) || (APP_ReadData(DEVICES_GetFusesAddress(), buf, len) == false))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Reading fuses failed");
+    return false;
+  }
+  memcpy(fuses->fuses, buf, fuses->number);
+  fuses->lockbit = buf[DEVICE_LOCKBIT_ADDR];
+
+  // Signature row is located separately
+  if (APP_ReadData(DEVICES_GetSigrowAddress(), fuses->signature, NVM_SIGNATURE_LEN) == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Reading signature failed");
+    return false;
+  }
+
+  return true;
+}
+
 /** \brief Write fuse value
  *
  * \param [in] fusenum Number of the fuse
@@ -236,12 +992,8 @@ uint8_t NVM_ReadFuse(uint8_t fusenum)
  */
 bool NVM_WriteFuse(uint8_t fusenum, uint8_t value)
 {
-  uint16_t fuse_address;
-  uint16_t address;
-  uint8_t data;
-
   // Must be in prog mode
-  if (NVM_Progmode == false)
+  if (SESSION_Current->progmode == false)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
     return false;
@@ -253,92 +1005,166 @@ bool NVM_WriteFuse(uint8_t fusenum, uint8_t value)
     return false;
   }
 
-  fuse_address = DEVICES_GetFusesAddress() + fusenum;
+  if (APP_WriteFuse(DEVICES_GetFusesAddress() + fusenum, value) == false)
+    return false;
+
+  return APP_WaitFlashReady();
+}
 
-  address = DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_ADDRL;
-  data = (uint8_t)(fuse_address & 0xff);
-  APP_WriteData(address, &data, sizeof(uint8_t));
+/** \brief Set fuses, only fuses with different values are written
+ *
+ * \param [in] fuses Wanted fuse values
+ * \param [in] mask Bit mask of the fuses to set
+ * \param [out] written Number of the fuses actually written
+ * \return true if all fuses in mask hold wanted values afterwards
+ *
+ */
+bool NVM_SetFuses(tNvmFuses *fuses, uint16_t mask, uint8_t *written)
+{
+  tNvmFuses current;
+  uint8_t i;
 
-  address = DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_ADDRH;
-  data = (uint8_t)(fuse_address >> 8);
-  APP_WriteData(address, &data, sizeof(uint8_t));
+  *written = 0;
+  if (NVM_ReadFuses(&current) == false)
+    return false;
 
-  address = DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_DATAL;
-  APP_WriteData(address, &value, sizeof(uint8_t));
+  for (i = 0; i < current.number; i++)
+  {
+    if (!(mask & (1 << i)) || (current.fuses[i] == fuses->fuses[i]))
+      continue;
+    LOG_Print(LOG_LEVEL_INFO, "Fuse %d: 0x%02X -> 0x%02X", i, current.fuses[i], fuses->fuses[i]);
+    // NVM controller ignores new commands while the previous one is running
+    if (!APP_WaitFlashReady())
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Flash not ready for fuse setting");
+      return false;
+    }
+    if (APP_WriteFuse(DEVICES_GetFusesAddress() + i, fuses->fuses[i]) == false)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Writing fuse %d failed", i);
+      return false;
+    }
+    (*written)++;
+  }
+  if (*written == 0)
+    return true;
 
-  address = DEVICES_GetNvmctrlAddress() + UPDI_NVMCTRL_CTRLA;
-  data = UPDI_NVMCTRL_CTRLA_WRITE_FUSE;
-  APP_WriteData(address, &data, sizeof(uint8_t));
+  // Single completion poll and read-back for the whole batch
+  if (!APP_WaitFlashReady())
+    return false;
+  if (NVM_ReadFuses(&current) == false)
+    return false;
+  for (i = 0; i < current.number; i++)
+  {
+    if ((mask & (1 << i)) && (current.fuses[i] != fuses->fuses[i]))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Fuse %d is 0x%02X after writing 0x%02X", i, current.fuses[i], fuses->fuses[i]);
+      return false;
+    }
+  }
 
   return true;
 }
 
-/** \brief Load data from Intel HEX format
+/** \brief Write image to flash, only the region with data is programmed
  *
- * \param [in] filename Name of the HEX file
+ * \param [in] image Image to write
  * \param [in] address Chip starting address
- * \param [in] len Length of the data
  * \return true if succeed
  *
  */
-bool NVM_LoadIhex(char *filename, uint16_t address, uint16_t len)
+bool NVM_WriteImage(tImage *image, uint16_t address)
 {
-  uint8_t *fdata;
-  uint8_t errCode;
-  uint16_t max_addr, min_addr;
-  FILE *fp;
-  bool res = false;
+  if (image->min_addr >= image->max_addr)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Image is empty, nothing to write");
+    return true;
+  }
 
-  fdata = malloc(len);
-  if (!fdata)
-  {
-    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %d bytes\n", (int)len);
-    return false;
+  return NVM_WriteFlash(address + image->min_addr, &image->data[image->min_addr], image->max_addr - image->min_addr);
+}
+
+/** \brief Verify flash content against image, only the region with data is read back
+ *
+ * \param [in] image Image to compare with
+ * \param [in] address Chip starting address
+ * \param [out] fail_addr Address of the first mismatch
+ * \return true if flash content is equal to the image
+ *
+ */
+bool NVM_VerifyImage(tImage *image, uint16_t address, uint16_t *fail_addr)
+{
+  *fail_addr = address;
+  if (image->min_addr >= image->max_addr)
+    return true;
+
+  return NVM_VerifyFlash(address + image->min_addr, &image->data[image->min_addr], image->max_addr - image->min_addr, fail_addr);
+}
+
+/** \brief Check that the flash region covered by image is erased
+ *
+ * \param [in] image Image to be written
+ * \param [in] address Chip starting address
+ * \param [out] fail_addr Address of the first programmed byte
+ * \return true if the region is blank
+ *
+ */
+bool NVM_BlankCheckImage(tImage *image, uint16_t address, uint16_t *fail_addr)
+{
+  *fail_addr = address;
+  if (image->min_addr >= image->max_addr)
+    return true;
+
+  return NVM_BlankCheck(address + image->min_addr, image->max_addr - image->min_addr, fail_addr);
+}
+
+/** \brief Verify flash content with the on-chip CRCSCAN peripheral
+ *         CRCSCAN only reports pass/fail against the checksum stored in
+ *         the last two bytes of flash, so the image has to carry it
+ *
+ * \param [in] image Full flash image to compare with
+ * \return NVM_CRC_MATCH, NVM_CRC_MISMATCH or NVM_CRC_UNAVAILABLE
+ *
+ */
+uint8_t NVM_VerifyImageCrc(tImage *image)
+{
+  uint16_t crc;
+  bool crc_ok;
+
+  // Must be in prog mode here
+  if (SESSION_Current->progmode == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Enter progmode first!");
+    return NVM_CRC_UNAVAILABLE;
   }
-  if ((fp = fopen(filename, "rt")) == NULL)
-  {
-    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
-    free(fdata);
-    return false;
-  }
-  max_addr = 0;
-  min_addr = 0xFFFF;
-  errCode = IHEX_ReadFile(fp, fdata, len, &min_addr, &max_addr);
-  switch (errCode)
-  {
-    case IHEX_ERROR_FILE:
-    case IHEX_ERROR_SIZE:
-    case IHEX_ERROR_FMT:
-    case IHEX_ERROR_CRC:
-      LOG_Print(LOG_LEVEL_ERROR, "Problem reading Hex file");
-      res = false;
-      break;
-    case IHEX_ERROR_NONE:
-      // write data buffer to flash
-      if (min_addr < max_addr)
-        res = NVM_WriteFlash(address + min_addr, &fdata[min_addr], max_addr - min_addr);
-      break;
+
+  if ((DEVICES_GetCrcscanAddress() == 0) || (image->size != DEVICES_GetFlashLength()))
+    return NVM_CRC_UNAVAILABLE;
+
+  crc = CRC_Ccitt16(CRC_CCITT16_INIT, image->data, image->size);
+  if (crc != 0)
+  {
+    LOG_Print(LOG_LEVEL_INFO, "Image has no valid CRC in the last flash word (residue 0x%04X)", crc);
+    return NVM_CRC_UNAVAILABLE;
   }
-  free(fdata);
-  fclose(fp);
 
-  // Size check: not implemented yet
+  if (APP_CrcScan(&crc_ok) == false)
+    return NVM_CRC_UNAVAILABLE;
 
-  return res;
+  return (crc_ok == true) ? NVM_CRC_MATCH : NVM_CRC_MISMATCH;
 }
 
-/** \brief Save file to Intel HEX format
+/** \brief Save memory content to image file, format is taken from the file extension
  *
- * \param [in] filename Name of the HEX file
+ * \param [in] filename Name of the image file
  * \param [in] address Chip starting address
  * \param [in] len Length of data
  * \return true if succeed
  *
  */
-bool NVM_SaveIhex(char *filename, uint16_t address, uint16_t len)
+bool NVM_SaveFile(char *filename, uint16_t address, uint16_t len)
 {
   uint8_t *fdata;
-  FILE *fp;
   bool res = false;
 
   fdata = malloc(len);
@@ -348,23 +1174,10 @@ bool NVM_SaveIhex(char *filename, uint16_t address, uint16_t len)
     return false;
   }
   memset(fdata, 0xff, len);
-  if ((fp = fopen(filename, "w")) == NULL)
-  {
-    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
-  } else
-  {
-    if (NVM_ReadFlash(address, fdata, len) == false)
-    {
-      LOG_Print(LOG_LEVEL_ERROR, "Reading from device failed");
-    } else
-    {
-      if (IHEX_WriteFile(fp, fdata, len) == IHEX_ERROR_NONE)
-        res = true;
-      else
-        LOG_Print(LOG_LEVEL_ERROR, "Problem writing Hex file");
-    }
-    fclose(fp);
-  }
+  if (NVM_ReadFlash(address, fdata, len) == false)
+    LOG_Print(LOG_LEVEL_ERROR, "Reading from device failed");
+  else
+    res = IMAGE_Save(filename, fdata, len);
   free(fdata);
 
   return res;
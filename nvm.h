@@ -3,16 +3,73 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "image.h"
 
 #define NVM_MAX_ERRORS    (3)
+#define NVM_MAX_RESUMES   (3)     // reconnects during one write
+#define NVM_BURST_SIZE    (256)
 
+#define NVM_FUSES_MAX     (16)
+#define NVM_SIGNATURE_LEN (3)
+#define NVM_SERIAL_LEN    (10)
+#define NVM_SERIAL_OFFSET (3)     // serial number in the signature row
+
+#define NVM_FUSE_APPEND       (7)     // CODESIZE on NVM version 2 parts
+#define NVM_FUSE_BOOTEND      (8)     // BOOTSIZE on NVM version 2 parts
+#define NVM_SECTION_UNIT      (256)   // flash section fuse unit in bytes
+#define NVM_SECTION_UNIT_V2   (512)
+
+typedef struct
+{
+  uint8_t number;
+  uint8_t fuses[NVM_FUSES_MAX];
+  uint8_t lockbit;
+  uint8_t signature[NVM_SIGNATURE_LEN];
+} tNvmFuses;
+
+/**< progress of an interrupted flash write */
+typedef struct
+{
+  uint32_t  hash;           // data, address and size of the write
+  uint16_t  address;
+  uint16_t  committed;      // bytes known to be written, 0 if nothing to resume
+  uint8_t   serial[NVM_SERIAL_LEN];
+} tNvmCheckpoint;
+
+enum {
+  NVM_CRC_MATCH,
+  NVM_CRC_MISMATCH,
+  NVM_CRC_UNAVAILABLE
+};
+
+bool NVM_GetDeviceInfo(bool detect);
 bool NVM_EnterProgmode(void);
 void NVM_LeaveProgmode(void);
 bool NVM_UnlockDevice(void);
 bool NVM_ChipErase(void);
 uint8_t NVM_ReadFuse(uint8_t fusenum);
 bool NVM_WriteFuse(uint8_t fusenum, uint8_t value);
-bool NVM_LoadIhex(char *filename, uint16_t address, uint16_t len);
-bool NVM_SaveIhex(char *filename, uint16_t address, uint16_t len);
+bool NVM_ReadFuses(tNvmFuses *fuses);
+bool NVM_SetFuses(tNvmFuses *fuses, uint16_t mask, uint8_t *written);
+bool NVM_ReadFlash(uint16_t address, uint8_t *data, uint16_t size);
+bool NVM_WriteFlash(uint16_t address, uint8_t *data, uint16_t size);
+bool NVM_GetAppSection(uint16_t *start, uint16_t *end);
+bool NVM_ErasePages(uint16_t address, uint16_t size);
+bool NVM_UpdateFlash(uint16_t address, uint8_t *data, uint16_t size, uint16_t *written);
+bool NVM_CheckpointMatches(uint16_t address, uint8_t *data, uint16_t size);
+void NVM_ClearCheckpoint(void);
+bool NVM_LoadCheckpoint(char *filename);
+bool NVM_SaveCheckpoint(char *filename);
+bool NVM_VerifyFlash(uint16_t address, uint8_t *data, uint16_t size, uint16_t *fail_addr);
+bool NVM_BlankCheck(uint16_t address, uint16_t size, uint16_t *fail_addr);
+bool NVM_ReadEeprom(uint16_t address, uint8_t *data, uint16_t size);
+bool NVM_WriteEeprom(uint16_t address, uint8_t *data, uint16_t size, uint16_t *written);
+bool NVM_WriteUserRow(uint8_t *data, uint16_t size, uint16_t *written);
+bool NVM_WriteUserRowLocked(uint8_t *data, uint16_t size);
+bool NVM_WriteImage(tImage *image, uint16_t address);
+bool NVM_VerifyImage(tImage *image, uint16_t address, uint16_t *fail_addr);
+bool NVM_BlankCheckImage(tImage *image, uint16_t address, uint16_t *fail_addr);
+uint8_t NVM_VerifyImageCrc(tImage *image);
+bool NVM_SaveFile(char *filename, uint16_t address, uint16_t len);
 
 #endif
@@ -1,9 +1,11 @@
 #include <unistd.h>
 #include "com.h"
+#include "instr.h"
 #include "log.h"
 #include "phy.h"
 #include "updi.h"
 #include "sleep.h"
+#include "stats.h"
 
 /** \brief Initialize physical interface
  *
@@ -18,20 +20,35 @@ bool PHY_Init(char *port, uint32_t baudrate, bool onDTR)
   return COM_Open(port, baudrate, true, true);
 }
 
-/** \brief Sends a double break to reset the UPDI port
- *         BREAK is actually just a slower zero frame
- *         A double break is guaranteed to push the UPDI state
- *         machine into a known state, albeit rather brutally
+/** \brief Sends single or double break to reset the UPDI port
+ *         A single break resets a UPDI that is just out of sync,
+ *         a double break is guaranteed to push the UPDI state
+ *         machine into a known state, albeit rather brutally.
+ *         The port stays open, only if it can't send a break
+ *         it is reopened to send slow zero frames instead
  *
  * \param [in] port Port name as string
+ * \param [in] baudrate Transmission baudrate to restore
+ * \param [in] count Number of breaks, 1 or 2
  * \return true if success
  *
  */
-bool PHY_DoBreak(char *port)
+bool PHY_DoBreak(char *port, uint32_t baudrate, uint8_t count)
 {
   uint8_t buf[] = {UPDI_BREAK, UPDI_BREAK};
 
-  LOG_Print(LOG_LEVEL_INFO, "Sending double break");
+  LOG_Print(LOG_LEVEL_INFO, "Sending %s break", (count > 1) ? "double" : "single");
+  if (COM_Break(PHY_BREAK_US) == true)
+  {
+    if (count > 1)
+    {
+      // one stop bit in between is enough, a short pause is safe for all adapters
+      msleep(1);
+      COM_Break(PHY_BREAK_US);
+    }
+    return true;
+  }
+
   COM_Close();
   // Re-init at a lower baudrate
   // At 300 bauds, the break character will pull the line low for 30ms
@@ -39,16 +56,14 @@ bool PHY_DoBreak(char *port)
   // no parity, one stop bit
   if (COM_Open(port, 300, false, false) != true)
     return false;
-  // Send two break characters, with 1 stop bit in between
-  COM_Write(buf, sizeof(buf));
-  // Wait for the double break end
-  msleep(1000);  // wait for 1 second
-  if (COM_Read(buf, 2) != 2)
+  // Send break characters, with 1 stop bit in between
+  COM_Write(buf, count);
+  // echo comes back once the breaks are out
+  if (COM_Read(buf, count) != count)
     LOG_Print(LOG_LEVEL_WARNING, "No answer received");
-
   COM_Close();
 
-  return true;
+  return PHY_Init(port, baudrate, false);
 }
 
 /** \brief Send data to physical interface
@@ -61,18 +76,21 @@ bool PHY_DoBreak(char *port)
 bool PHY_Send(uint8_t *data, uint8_t len)
 {
   //uint8_t i;
+  INSTR_TIME(start);
 
   /*for (i = 0; i < len; i++)
   {
     COM_Write(&data[i], 1);
   }*/
   COM_Write(data, len);
+  STATS_AddTx(len);
   // read echo
   //usleep(10);
   //msleep(COM_GetTransTime(len));
   //Sleep(10);
 
   COM_Read(data, len);
+  INSTR_RECORD(INSTR_PHY_SEND, len, start);
 
   return true;
 }
@@ -86,12 +104,30 @@ bool PHY_Send(uint8_t *data, uint8_t len)
  */
 bool PHY_Receive(uint8_t *data, uint16_t len)
 {
+  INSTR_TIME(start);
   int val = COM_Read(data, len);
+  INSTR_RECORD(INSTR_PHY_RECEIVE, (val > 0) ? val : 0, start);
+  INSTR_RESPONSE(start, val == len);
+  if (val != len)
+    INSTR_TIMEOUT(INSTR_PHY_RECEIVE);
+  if (val > 0)
+    STATS_AddRx((uint16_t)val);
   if ((val < 0) || (val != len))
     return false;
   return true;
 }
 
+/** \brief Set timeout of the following receives
+ *
+ * \param [in] timeout_us Timeout in microseconds, 0 for the port default
+ * \return Nothing
+ *
+ */
+void PHY_SetTimeout(uint32_t timeout_us)
+{
+  COM_SetTimeout(timeout_us);
+}
+
 /** \brief Close physical interface
  *
  * \return Nothing
@@ -4,12 +4,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PHY_BAUDRATE      (115200)
+#define PHY_BREAK_US      (25000)   // above the 24.6 ms for the slowest UPDI clock
 
 bool PHY_Init(char *port, uint32_t baudrate, bool onDTR);
-bool PHY_DoBreak(char *port);
+bool PHY_DoBreak(char *port, uint32_t baudrate, uint8_t count);
 bool PHY_Send(uint8_t *data, uint8_t len);
 bool PHY_Receive(uint8_t *data, uint16_t len);
+void PHY_SetTimeout(uint32_t timeout_us);
 void PHY_Close(void);
 
 #endif
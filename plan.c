@@ -0,0 +1,981 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include "devices.h"
+#include "image.h"
+#include "log.h"
+#include "nvm.h"
+#include "plan.h"
+#include "session.h"
+#include "stats.h"
+
+static const char *PLAN_OpNames[] = {
+  "unlock", "blank-check", "erase", "fuses-write", "write", "fuses-read", "verify", "read", "lock"
+};
+
+static const char *PLAN_MemNames[] = {
+  "", "flash", "eeprom", "userrow"
+};
+
+static const char *PLAN_MemTitles[] = {
+  "", "flash", "EEPROM", "user row"
+};
+
+/** \brief Get chip area of the memory
+ *
+ * \param [in] memory Memory type
+ * \param [out] start Chip starting address
+ * \param [out] len Length of the memory
+ * \return Nothing
+ *
+ */
+static void PLAN_GetArea(uint8_t memory, uint16_t *start, uint16_t *len)
+{
+  switch (memory)
+  {
+    case PLAN_MEM_EEPROM:
+      *start = DEVICES_GetEepromStart();
+      *len = DEVICES_GetEepromLength();
+      break;
+    case PLAN_MEM_USERROW:
+      *start = DEVICES_GetUserrowAddress();
+      *len = DEVICES_GetUserrowLength();
+      break;
+    default:
+      *start = DEVICES_GetFlashStart();
+      *len = DEVICES_GetFlashLength();
+      break;
+  }
+}
+
+/** \brief Parse fuse settings in form "X:0xYY X:0xYY ..."
+ *
+ * \param [out] step Plan step to fill
+ * \param [in] text Fuse settings
+ * \return true if succeed
+ *
+ */
+static bool PLAN_ParseFuses(tPlanStep *step, char *text)
+{
+  char *pch;
+  unsigned int num;
+  unsigned int value;
+
+  pch = text;
+  while (pch != NULL)
+  {
+    while (isspace((unsigned char)*pch))
+      pch++;
+    if (*pch == 0)
+      break;
+    if ((sscanf(pch, "%u:0x%02X", &num, &value) != 2) || (num >= PLAN_FUSES_MAX) || (value > 0xFF))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Wrong fuse settings at: _%.12s...", pch);
+      return false;
+    }
+    step->fuses[num] = (uint8_t)value;
+    step->mask |= 1 << num;
+    pch = strchr(pch, ' ');
+  }
+
+  return (step->mask != 0);
+}
+
+/** \brief Initialize empty plan
+ *
+ * \param [out] plan Plan to initialize
+ * \return Nothing
+ *
+ */
+void PLAN_Init(tPlan *plan)
+{
+  memset(plan, 0, sizeof(tPlan));
+}
+
+/** \brief Append one step to the plan
+ *
+ * \param [in,out] plan Plan to extend
+ * \param [in] op Step operation (PLAN_OP_xxx)
+ * \param [in] memory Memory for write/verify/read/blank-check (PLAN_MEM_xxx)
+ * \param [in] arg File name or fuse settings, NULL if not needed
+ * \return true if succeed
+ *
+ */
+bool PLAN_AddStep(tPlan *plan, uint8_t op, uint8_t memory, char *arg)
+{
+  tPlanStep *step;
+
+  if (plan->number >= PLAN_MAX_STEPS)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Too many steps, maximum is %d", PLAN_MAX_STEPS);
+    return false;
+  }
+  step = &plan->steps[plan->number];
+  memset(step, 0, sizeof(tPlanStep));
+  step->op = op;
+  step->memory = memory;
+  switch (op)
+  {
+    case PLAN_OP_WRITE:
+    case PLAN_OP_VERIFY:
+    case PLAN_OP_READ:
+      if ((arg == NULL) || (strlen(arg) == 0) || (strlen(arg) >= PLAN_FILENAME_LEN))
+      {
+        LOG_Print(LOG_LEVEL_ERROR, "%s: wrong file name", PLAN_OpNames[op]);
+        return false;
+      }
+      strcpy(step->file, arg);
+      break;
+    case PLAN_OP_FUSES_WRITE:
+      if ((arg == NULL) || (PLAN_ParseFuses(step, arg) == false))
+        return false;
+      break;
+    default:
+      break;
+  }
+  plan->number++;
+
+  return true;
+}
+
+/** \brief Parse one plan line and append its step
+ *
+ * Syntax: "unlock", "erase", "lock", "fuses-read", "fuses-write X:0xYY ...",
+ * "blank-check [MEMORY]", "write|verify|read MEMORY FILE",
+ * where MEMORY is flash, eeprom or userrow. Text after '#' is ignored.
+ *
+ * \param [in,out] plan Plan to extend
+ * \param [in] line Plan line, modified while parsing
+ * \return true if succeed
+ *
+ */
+bool PLAN_AddLine(tPlan *plan, char *line)
+{
+  char *pch;
+  char *tok;
+  uint8_t op;
+  uint8_t memory;
+
+  pch = strchr(line, '#');
+  if (pch != NULL)
+    *pch = 0;
+  tok = strtok(line, " \t\r\n");
+  if (tok == NULL)
+    return true;
+  for (op = 0; op < sizeof(PLAN_OpNames) / sizeof(PLAN_OpNames[0]); op++)
+  {
+    if (strcmp(tok, PLAN_OpNames[op]) == 0)
+      break;
+  }
+  if (op >= sizeof(PLAN_OpNames) / sizeof(PLAN_OpNames[0]))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unknown plan operation: %s", tok);
+    return false;
+  }
+  if (op == PLAN_OP_FUSES_WRITE)
+    return PLAN_AddStep(plan, op, PLAN_MEM_NONE, strtok(NULL, "\r\n"));
+
+  memory = PLAN_MEM_NONE;
+  if ((op == PLAN_OP_BLANK_CHECK) || (op == PLAN_OP_WRITE) || (op == PLAN_OP_VERIFY) || (op == PLAN_OP_READ))
+  {
+    tok = strtok(NULL, " \t\r\n");
+    if ((tok == NULL) && (op == PLAN_OP_BLANK_CHECK))
+    {
+      // no memory given: check everything chip erase clears
+      return PLAN_AddStep(plan, op, PLAN_MEM_FLASH, NULL) && PLAN_AddStep(plan, op, PLAN_MEM_EEPROM, NULL);
+    }
+    for (memory = PLAN_MEM_FLASH; (tok != NULL) && (memory <= PLAN_MEM_USERROW); memory++)
+    {
+      if (strcmp(tok, PLAN_MemNames[memory]) == 0)
+        break;
+    }
+    if ((tok == NULL) || (memory > PLAN_MEM_USERROW))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "%s: wrong or missing memory type", PLAN_OpNames[op]);
+      return false;
+    }
+  }
+
+  return PLAN_AddStep(plan, op, memory, strtok(NULL, " \t\r\n"));
+}
+
+/** \brief Load plan steps from file, one step per line
+ *
+ * \param [in,out] plan Plan to extend
+ * \param [in] filename Name of the plan file
+ * \return true if succeed
+ *
+ */
+bool PLAN_LoadFile(tPlan *plan, char *filename)
+{
+  FILE *fp;
+  char line[PLAN_LINE_LEN];
+  uint16_t number;
+  bool res = true;
+
+  if ((fp = fopen(filename, "r")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  number = 0;
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    number++;
+    if (PLAN_AddLine(plan, line) == false)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "%s: error in line %d", filename, number);
+      res = false;
+      break;
+    }
+  }
+  fclose(fp);
+
+  return res;
+}
+
+/** \brief Check if the step is a fuse operation
+ *
+ * \param [in] step Plan step
+ * \return true if the step reads or writes fuses
+ *
+ */
+static bool PLAN_IsFuses(tPlanStep *step)
+{
+  return (step->op == PLAN_OP_FUSES_READ) || (step->op == PLAN_OP_FUSES_WRITE);
+}
+
+/** \brief Check if two steps must keep their order
+ *
+ * Erase, blank check and lock stay where they were given. A write keeps its
+ * place relative to other steps on the same memory, fuse writes relative to
+ * fuse reads. Unlock is done before programming mode, it goes first anyway.
+ *
+ * \param [in] a Plan step
+ * \param [in] b Other plan step
+ * \return true if the steps can't be swapped
+ *
+ */
+static bool PLAN_Conflicts(tPlanStep *a, tPlanStep *b)
+{
+  if ((a->op == PLAN_OP_UNLOCK) || (b->op == PLAN_OP_UNLOCK))
+    return false;
+  if ((a->op == PLAN_OP_ERASE) || (a->op == PLAN_OP_BLANK_CHECK) || (a->op == PLAN_OP_LOCK) ||
+      (b->op == PLAN_OP_ERASE) || (b->op == PLAN_OP_BLANK_CHECK) || (b->op == PLAN_OP_LOCK))
+    return true;
+  if ((PLAN_IsFuses(a) == true) && (PLAN_IsFuses(b) == true))
+    return (a->op == PLAN_OP_FUSES_WRITE) || (b->op == PLAN_OP_FUSES_WRITE);
+  if ((PLAN_IsFuses(a) == true) || (PLAN_IsFuses(b) == true))
+    return false;
+  return (a->memory == b->memory) && ((a->op == PLAN_OP_WRITE) || (b->op == PLAN_OP_WRITE));
+}
+
+/** \brief Check if the step changes memory a chip erase clears
+ *
+ * \param [in] step Plan step
+ * \return true if the step writes flash or EEPROM
+ *
+ */
+static bool PLAN_WritesErasable(tPlanStep *step)
+{
+  return (step->op == PLAN_OP_WRITE) &&
+         ((step->memory == PLAN_MEM_FLASH) || (step->memory == PLAN_MEM_EEPROM));
+}
+
+/** \brief Check if the verify step checks the image written last to its memory
+ *
+ * \param [in] plan Plan being optimized
+ * \param [in] n Number of the steps kept so far
+ * \param [in] step Verify step
+ * \return true if the image is verified right after writing anyway
+ *
+ */
+static bool PLAN_VerifiedByWrite(tPlan *plan, uint8_t n, tPlanStep *step)
+{
+  tPlanStep *prev;
+
+  while (n-- > 0)
+  {
+    prev = &plan->steps[n];
+    if ((prev->op == PLAN_OP_ERASE) || (prev->op == PLAN_OP_UNLOCK))
+      return false;
+    if ((prev->op == PLAN_OP_WRITE) && (prev->memory == step->memory))
+      return (strcmp(prev->file, step->file) == 0);
+  }
+  return false;
+}
+
+/** \brief Reorder plan steps and drop redundant ones
+ *
+ * Steps are sorted by execution phase as far as they don't depend on each
+ * other, so writes to one memory are grouped. Fuses are written in one batch
+ * while no fuse read is in between. An erase is dropped only if nothing was
+ * written since the previous erase or unlock.
+ *
+ * \param [in,out] plan Plan to optimize
+ * \return Nothing
+ *
+ */
+void PLAN_Optimize(tPlan *plan)
+{
+  tPlanStep step;
+  tPlanStep *fuses;
+  tPlanStep *prev;
+  uint8_t i;
+  uint8_t j;
+  uint8_t n;
+  bool erase;
+
+  // stable insertion sort by execution phase, dependent steps are not swapped
+  for (i = 1; i < plan->number; i++)
+  {
+    step = plan->steps[i];
+    for (j = i; j > 0; j--)
+    {
+      prev = &plan->steps[j - 1];
+      if ((prev->op * 4 + prev->memory <= step.op * 4 + step.memory) || (PLAN_Conflicts(prev, &step) == true))
+        break;
+      plan->steps[j] = *prev;
+    }
+    plan->steps[j] = step;
+  }
+
+  erase = false;
+  fuses = NULL;
+  n = 0;
+  for (i = 0; i < plan->number; i++)
+  {
+    tPlanStep *cur = &plan->steps[i];
+
+    prev = (n > 0) ? &plan->steps[n - 1] : NULL;
+    if ((cur->op == PLAN_OP_UNLOCK) || (cur->op == PLAN_OP_ERASE))
+    {
+      // unlocking erases the chip too
+      if (erase == true)
+        continue;
+      erase = true;
+    } else
+    if (cur->op == PLAN_OP_FUSES_WRITE)
+    {
+      if (fuses != NULL)
+      {
+        for (j = 0; j < PLAN_FUSES_MAX; j++)
+        {
+          if (cur->mask & (1 << j))
+            fuses->fuses[j] = cur->fuses[j];
+        }
+        fuses->mask |= cur->mask;
+        continue;
+      }
+    } else
+    if ((prev != NULL) && (prev->op == cur->op) && (prev->memory == cur->memory) &&
+        (strcmp(prev->file, cur->file) == 0))
+    {
+      // repeating the same step gives nothing
+      continue;
+    } else
+    if ((plan->verify == true) && (cur->op == PLAN_OP_VERIFY) && (PLAN_VerifiedByWrite(plan, n, cur) == true))
+    {
+      // written images are verified right after writing
+      continue;
+    }
+    if (PLAN_WritesErasable(cur) == true)
+      erase = false;
+    // batch must not move over a fuse read or a lock
+    if ((cur->op == PLAN_OP_FUSES_READ) || (cur->op == PLAN_OP_LOCK))
+      fuses = NULL;
+    if (n != i)
+      plan->steps[n] = *cur;
+    if ((plan->steps[n].op == PLAN_OP_FUSES_WRITE) && (fuses == NULL))
+      fuses = &plan->steps[n];
+    n++;
+  }
+  if (n != plan->number)
+    LOG_Print(LOG_LEVEL_INFO, "Plan: %d redundant steps dropped", plan->number - n);
+  plan->number = n;
+}
+
+/** \brief Print plan steps
+ *
+ * \param [in] plan Plan to print
+ * \return Nothing
+ *
+ */
+void PLAN_Print(tPlan *plan)
+{
+  uint8_t i;
+  uint8_t j;
+
+  for (i = 0; i < plan->number; i++)
+  {
+    printf("  %2d: %s", i + 1, PLAN_OpNames[plan->steps[i].op]);
+    if (plan->steps[i].memory != PLAN_MEM_NONE)
+      printf(" %s", PLAN_MemNames[plan->steps[i].memory]);
+    if (plan->steps[i].file[0] != 0)
+      printf(" %s", plan->steps[i].file);
+    for (j = 0; j < PLAN_FUSES_MAX; j++)
+    {
+      if (plan->steps[i].mask & (1 << j))
+        printf(" %d:0x%02X", j, plan->steps[i].fuses[j]);
+    }
+    printf("\n");
+  }
+}
+
+/** \brief Load image for the step
+ *
+ * Images opened through the plan hook are kept in the image cache.
+ *
+ * \param [in] plan Plan with loading settings
+ * \param [out] image Image to fill
+ * \param [in] file File name
+ * \param [in] size Size of the target memory
+ * \return true if succeed
+ *
+ */
+static bool PLAN_LoadImage(tPlan *plan, tImage *image, char *file, uint16_t size)
+{
+  FILE *fp;
+  bool res;
+
+  if (plan->open == NULL)
+    return IMAGE_Load(image, file, size, plan->offset);
+  if ((fp = plan->open(file)) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", file);
+    return false;
+  }
+  res = IMAGE_LoadCached(image, fp, file, size, plan->offset);
+  fclose(fp);
+
+  return res;
+}
+
+/** \brief Verify memory content against the image and report the result
+ *
+ * \param [in] plan Plan with verification settings
+ * \param [in] image Image to compare with
+ * \param [in] address Chip starting address of the memory
+ * \return true if memory content matches the image
+ *
+ */
+static bool PLAN_Verify(tPlan *plan, tImage *image, uint16_t address)
+{
+  uint16_t fail_addr;
+
+  if ((plan->verify_crc == true) && (address == DEVICES_GetFlashStart()))
+  {
+    switch (NVM_VerifyImageCrc(image))
+    {
+      case NVM_CRC_MATCH:
+        printf("Verification OK (on-chip CRC)\n");
+        return true;
+      case NVM_CRC_MISMATCH:
+        printf("On-chip CRC mismatch, reading back\n");
+        break;
+      default:
+        printf("On-chip CRC not available, reading back\n");
+        break;
+    }
+  }
+  if (NVM_VerifyImage(image, address, &fail_addr) == false)
+  {
+    printf("Verification failed at address 0x%04X\n", fail_addr);
+    return false;
+  }
+  printf("Verification OK\n");
+  return true;
+}
+
+/** \brief Get application code section as flash offsets
+ *
+ * Flash may reach the top of the data space, chip addresses are made from
+ * the offsets only when a write is issued.
+ *
+ * \param [out] start Section start
+ * \param [out] end Section end, not included
+ * \return true if succeed
+ *
+ */
+static bool PLAN_GetAppArea(uint32_t *start, uint32_t *end)
+{
+  uint32_t flash_start = DEVICES_GetFlashStart();
+  uint16_t first;
+  uint16_t last;
+
+  if (NVM_GetAppSection(&first, &last) == false)
+  {
+    printf("Application section is unknown, nothing is written\n");
+    return false;
+  }
+  *start = first;
+  *end = last;
+  printf("Application section: 0x%04X-0x%04X\n", flash_start + *start, flash_start + *end - 1);
+  return true;
+}
+
+/** \brief Erase application code section page by page
+ *
+ * \return true if succeed
+ *
+ */
+static bool PLAN_EraseApp(void)
+{
+  uint32_t start;
+  uint32_t end;
+
+  if (PLAN_GetAppArea(&start, &end) == false)
+    return false;
+  printf("Erasing application section\n");
+  return NVM_ErasePages(DEVICES_GetFlashStart() + start, end - start);
+}
+
+/** \brief Get whole pages covered by the image, they are what an
+ *         application write erases and writes
+ *
+ * \param [in] image Image to write
+ * \param [out] first Offset of the first page
+ * \param [out] last Offset after the last page
+ * \return Nothing
+ *
+ */
+static void PLAN_GetAppPages(tImage *image, uint32_t *first, uint32_t *last)
+{
+  uint32_t page_size = DEVICES_GetPageSize();
+
+  *first = image->min_addr / page_size * page_size;
+  *last = (image->max_addr + page_size - 1) / page_size * page_size;
+}
+
+/** \brief Write flash image into application code section, boot and application
+ *         data sections are not touched
+ *
+ * \param [in] image Image to write
+ * \param [in] erased Section was erased in this session
+ * \return true if succeed
+ *
+ */
+static bool PLAN_WriteApp(tImage *image, bool erased)
+{
+  uint32_t flash_start = DEVICES_GetFlashStart();
+  uint32_t start;
+  uint32_t end;
+  uint32_t first;
+  uint32_t last;
+  uint16_t written;
+
+  if (image->min_addr >= image->max_addr)
+  {
+    printf("Image is empty, nothing to write\n");
+    return true;
+  }
+  if (PLAN_GetAppArea(&start, &end) == false)
+    return false;
+  // whole pages are erased and written, the image buffer is padded with 0xFF
+  PLAN_GetAppPages(image, &first, &last);
+  if ((first < start) || (last > end))
+  {
+    printf("Image at 0x%04X-0x%04X is outside the application section\n", flash_start + image->min_addr,
+           flash_start + image->max_addr - 1);
+    return false;
+  }
+  // erased pages need no erase, only the changed ones are written otherwise
+  if (erased == true)
+    return NVM_WriteFlash(flash_start + first, &image->data[first], last - first);
+  if (NVM_UpdateFlash(flash_start + first, &image->data[first], last - first, &written) == false)
+    return false;
+  printf("Application pages changed: %d of %d\n", written, (last - first) / DEVICES_GetPageSize());
+  return true;
+}
+
+/** \brief Write image file into the memory
+ *
+ * \param [in] plan Plan with writing settings
+ * \param [in] step Plan step
+ * \param [in,out] erased Chip was erased in this session
+ * \return true if succeed
+ *
+ */
+static bool PLAN_Write(tPlan *plan, tPlanStep *step, bool *erased)
+{
+  tImage image;
+  uint16_t start;
+  uint16_t len;
+  uint16_t val;
+  bool res;
+
+  PLAN_GetArea(step->memory, &start, &len);
+  printf("Writing %s from file: %s\n", PLAN_MemTitles[step->memory], step->file);
+  if (PLAN_LoadImage(plan, &image, step->file, len) == false)
+    return false;
+  switch (step->memory)
+  {
+    case PLAN_MEM_FLASH:
+      if (plan->app_only == true)
+      {
+        res = PLAN_WriteApp(&image, *erased);
+        break;
+      }
+      if ((plan->auto_erase == true) && (*erased == false))
+      {
+        // fresh parts are blank already, erase only if needed
+        if (NVM_BlankCheckImage(&image, start, &val) == true)
+        {
+          printf("Target area is blank, skipping erase\n");
+        } else
+        {
+          printf("Erasing\n");
+          if (NVM_ChipErase() == false)
+          {
+            IMAGE_Free(&image);
+            return false;
+          }
+          *erased = true;
+        }
+      }
+      res = NVM_WriteImage(&image, start);
+      break;
+    case PLAN_MEM_EEPROM:
+      res = NVM_WriteEeprom(start + image.min_addr, &image.data[image.min_addr],
+                            image.max_addr - image.min_addr, &val);
+      if (res == true)
+        printf("EEPROM bytes changed: %d\n", val);
+      break;
+    default:
+      // user row is a single page, file content replaces it as a whole
+      res = NVM_WriteUserRow(image.data, image.size, &val);
+      if (res == true)
+        printf("User row bytes changed: %d\n", val);
+      break;
+  }
+  if ((res == true) && (plan->verify == true))
+    res = PLAN_Verify(plan, &image, start);
+  IMAGE_Free(&image);
+
+  return res;
+}
+
+/** \brief Write fuses of the step, only changed ones are written
+ *
+ * \param [in] step Plan step
+ * \return true if succeed
+ *
+ */
+static bool PLAN_WriteFuses(tPlanStep *step)
+{
+  tNvmFuses fuses;
+  uint16_t mask;
+  uint8_t written;
+  uint8_t i;
+
+  mask = 0;
+  for (i = 0; i < PLAN_FUSES_MAX; i++)
+  {
+    if ((step->mask & (1 << i)) == 0)
+      continue;
+    if (i >= DEVICES_GetFusesNumber())
+    {
+      printf("Wrong fuse number: %d\n", i);
+      continue;
+    }
+    printf("Setting fuse Nr. %d to 0x%02X\n", i, step->fuses[i]);
+    fuses.fuses[i] = step->fuses[i];
+    mask |= 1 << i;
+  }
+  if (mask == 0)
+    return true;
+  if (NVM_SetFuses(&fuses, mask, &written) == false)
+  {
+    printf("Writing fuses failed\n");
+    return false;
+  }
+  printf("Fuses written: %d\n", written);
+
+  return true;
+}
+
+/** \brief Read fuses, lock byte and signature and print them
+ *
+ * \return true if succeed
+ *
+ */
+static bool PLAN_ReadFuses(void)
+{
+  tNvmFuses fuses;
+  uint8_t i;
+
+  printf("Reading fuses:\n");
+  if (NVM_ReadFuses(&fuses) == false)
+    return false;
+  for (i = 0; i < fuses.number; i++)
+  {
+    printf("  0x%02X: 0x%02X\n", i, fuses.fuses[i]);
+  }
+  printf("  Lock: 0x%02X\n", fuses.lockbit);
+  printf("  Signature: 0x%02X 0x%02X 0x%02X\n", fuses.signature[0], fuses.signature[1], fuses.signature[2]);
+
+  return true;
+}
+
+/** \brief Read memory into file
+ *
+ * \param [in] step Plan step
+ * \return true if succeed
+ *
+ */
+static bool PLAN_Read(tPlanStep *step)
+{
+  char cwd[PATH_MAX];
+  char ch;
+  uint16_t start;
+  uint16_t len;
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    cwd[0] = 0;
+  #ifdef __MINGW32__
+  ch = '\\';
+  #endif // __MINGW32__
+  #if defined(__APPLE__) || defined(__linux)
+  ch = '/';
+  #endif // __linux
+  if (strchr(step->file, ch) != NULL)
+  {
+    cwd[0] = 0;
+    ch = 0;
+  }
+  printf("Reading %s to file: %s%c%s\n", PLAN_MemTitles[step->memory], cwd, ch, step->file);
+  PLAN_GetArea(step->memory, &start, &len);
+
+  return NVM_SaveFile(step->file, start, len);
+}
+
+/** \brief Execute one plan step in programming mode
+ *
+ * \param [in] plan Plan with settings
+ * \param [in] step Plan step
+ * \param [in,out] erased Chip was erased in this session
+ * \return true if succeed
+ *
+ */
+static bool PLAN_ExecuteStep(tPlan *plan, tPlanStep *step, bool *erased)
+{
+  tImage image;
+  uint16_t start;
+  uint16_t len;
+  uint16_t val;
+  bool res;
+
+  switch (step->op)
+  {
+    case PLAN_OP_BLANK_CHECK:
+      PLAN_GetArea(step->memory, &start, &len);
+      if (NVM_BlankCheck(start, len, &val) == false)
+      {
+        printf("Blank check of %s failed at address 0x%04X\n", PLAN_MemTitles[step->memory], val);
+        return false;
+      }
+      printf("Blank check of %s: OK\n", PLAN_MemTitles[step->memory]);
+      return true;
+    case PLAN_OP_ERASE:
+      if (plan->app_only == true)
+      {
+        res = PLAN_EraseApp();
+      } else
+      {
+        printf("Erasing\n");
+        res = NVM_ChipErase();
+      }
+      // writes after a failed erase must not assume blank flash
+      if (res == true)
+        *erased = true;
+      return res;
+    case PLAN_OP_FUSES_WRITE:
+      return PLAN_WriteFuses(step);
+    case PLAN_OP_FUSES_READ:
+      return PLAN_ReadFuses();
+    case PLAN_OP_WRITE:
+      return PLAN_Write(plan, step, erased);
+    case PLAN_OP_VERIFY:
+      PLAN_GetArea(step->memory, &start, &len);
+      printf("Verifying %s with file: %s\n", PLAN_MemTitles[step->memory], step->file);
+      if (PLAN_LoadImage(plan, &image, step->file, len) == false)
+        return false;
+      res = PLAN_Verify(plan, &image, start);
+      IMAGE_Free(&image);
+      return res;
+    case PLAN_OP_READ:
+      return PLAN_Read(step);
+    case PLAN_OP_LOCK:
+      printf("Locking MCU...   ");
+      if (NVM_WriteFuse(DEVICE_LOCKBIT_ADDR, 0x00) == false)
+        return false;
+      printf("OK\n");
+      return true;
+    default:
+      return true;
+  }
+}
+
+/** \brief Check if the plan continues an interrupted flash write on this very part
+ *
+ * \param [in] plan Plan to execute
+ * \return true if the write is resumed, the chip must not be erased then
+ *
+ */
+static bool PLAN_Resumable(tPlan *plan)
+{
+  tImage image;
+  uint16_t start;
+  uint16_t len;
+  uint32_t first;
+  uint32_t last;
+  uint8_t i;
+  bool res = false;
+
+  if (SESSION_Current->checkpoint.committed == 0)
+    return false;
+  for (i = 0; i < plan->number; i++)
+  {
+    if ((plan->steps[i].op != PLAN_OP_WRITE) || (plan->steps[i].memory != PLAN_MEM_FLASH))
+      continue;
+    PLAN_GetArea(PLAN_MEM_FLASH, &start, &len);
+    if (PLAN_LoadImage(plan, &image, plan->steps[i].file, len) == true)
+    {
+      // the key must be the one the write step uses, application writes start at a page
+      if (plan->app_only == true)
+      {
+        PLAN_GetAppPages(&image, &first, &last);
+        res = NVM_CheckpointMatches(start + first, &image.data[first], last - first);
+      } else
+      {
+        res = NVM_CheckpointMatches(start + image.min_addr, &image.data[image.min_addr],
+                                    image.max_addr - image.min_addr);
+      }
+      IMAGE_Free(&image);
+    }
+    break;
+  }
+  if (res == false)
+    NVM_ClearCheckpoint();
+
+  return res;
+}
+
+/** \brief Write user rows of a locked device, other steps can't be done
+ *
+ * \param [in] plan Plan to execute
+ * \return true if succeed
+ *
+ */
+static bool PLAN_ExecuteLocked(tPlan *plan)
+{
+  tImage image;
+  uint8_t i;
+  bool done = false;
+  bool res = true;
+
+  for (i = 0; i < plan->number; i++)
+  {
+    if ((plan->steps[i].op != PLAN_OP_WRITE) || (plan->steps[i].memory != PLAN_MEM_USERROW))
+      continue;
+    // the user row is still writable with its own key
+    printf("Writing user row of locked device from file: %s\n", plan->steps[i].file);
+    done = true;
+    if (PLAN_LoadImage(plan, &image, plan->steps[i].file, DEVICES_GetUserrowLength()) == true)
+    {
+      if (NVM_WriteUserRowLocked(image.data, image.size) == true)
+        printf("OK\n");
+      else
+        res = false;
+      IMAGE_Free(&image);
+    } else
+    {
+      res = false;
+    }
+  }
+  if (done == false)
+  {
+    printf("Can't enter programming mode, exiting\n");
+    return false;
+  }
+  if (res == true)
+    LOG_Print(LOG_LEVEL_WARNING, "Device is locked, only user row was written");
+
+  return res;
+}
+
+/** \brief Execute all plan steps in one programming mode session,
+ *         the first failed step stops the plan
+ *
+ * \param [in] plan Plan to execute, normally optimized already
+ * \return true if all steps succeed
+ *
+ */
+bool PLAN_Execute(tPlan *plan)
+{
+  char name[STATS_NAME_LEN];
+  uint8_t i;
+  bool erased = false;
+  bool resume;
+  bool res = true;
+
+  // wrong device type would fail much later and slower
+  STATS_Begin("device");
+  if (NVM_GetDeviceInfo(SESSION_Current->detect) == false)
+  {
+    STATS_End();
+    return false;
+  }
+  for (i = 0; (i < plan->number) && (plan->steps[i].op == PLAN_OP_UNLOCK); i++)
+  {
+    STATS_Begin("unlock");
+    printf("Unlocking...   ");
+    if (NVM_UnlockDevice() == true)
+    {
+      printf("OK\n");
+      erased = true;
+    }
+  }
+  STATS_Begin("progmode");
+  if (NVM_EnterProgmode() == false)
+  {
+    STATS_Begin("locked");
+    res = PLAN_ExecuteLocked(plan);
+    STATS_End();
+    return res;
+  }
+  // erased part of an interrupted write must stay as it is
+  resume = PLAN_Resumable(plan);
+  if (resume == true)
+    erased = true;
+
+  for (; i < plan->number; i++)
+  {
+    if ((resume == true) && (plan->steps[i].op == PLAN_OP_ERASE))
+    {
+      printf("Interrupted write is resumed, skipping erase\n");
+      continue;
+    }
+    LOG_Print(LOG_LEVEL_INFO, "Step %d of %d: %s %s", i + 1, plan->number,
+              PLAN_OpNames[plan->steps[i].op], PLAN_MemNames[plan->steps[i].memory]);
+    // phase name is the step as it reads in the plan, e.g. "write-flash"
+    snprintf(name, sizeof(name), "%s%s%s", PLAN_OpNames[plan->steps[i].op],
+             (plan->steps[i].memory != PLAN_MEM_NONE) ? "-" : "", PLAN_MemNames[plan->steps[i].memory]);
+    STATS_Begin(name);
+    // later steps, e.g. lock, must not run on a part with a bad image
+    if (PLAN_ExecuteStep(plan, &plan->steps[i], &erased) == false)
+    {
+      printf("Step %d (%s) failed, remaining steps are skipped\n", i + 1, name);
+      res = false;
+      break;
+    }
+  }
+  STATS_Begin("leave");
+  NVM_LeaveProgmode();
+  STATS_End();
+
+  return res;
+}
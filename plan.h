@@ -0,0 +1,8 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "libupdi.h"
+
+bool PLAN_Execute(tPlan *plan);
+
+#endif
@@ -1,20 +1,20 @@
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "progress.h"
+#include "session.h"
+#include "stats.h"
 
-/** \brief Print progress bar with prefix
+/** \brief Draw progress bar with prefix, rate and ETA on the terminal line
  *
- * \param [in] iteration Current iteration
- * \param [in] total Total number of iterations
- * \param [in] prefix Prefix text
+ * \param [in] progress Progress to show
  * \param [in] fill Char to use for filling the bar
- * \return Noting
+ * \return Nothing
  *
  */
-void PROGRESS_Print(uint16_t iteration, uint16_t total, char *prefix, char fill)
+static void PROGRESS_Bar(tProgress *progress, char fill)
 {
   uint8_t filledLength;
-  float percent;
   char bar[PROGRESS_BAR_LENGTH + 1];
   char bar2[PROGRESS_BAR_LENGTH + 1];
 
@@ -22,23 +22,111 @@ void PROGRESS_Print(uint16_t iteration, uint16_t total, char *prefix, char fill)
   bar[PROGRESS_BAR_LENGTH] = 0;
   memset(bar2, ' ', PROGRESS_BAR_LENGTH);
   bar2[PROGRESS_BAR_LENGTH] = 0;
-  percent = (float)iteration / total * 100;
-  filledLength = (uint8_t)(PROGRESS_BAR_LENGTH * iteration / total);
+  filledLength = (uint8_t)((uint64_t)PROGRESS_BAR_LENGTH * progress->done / progress->total);
 
-  printf("\r%s [%.*s%.*s] %.1f%%", prefix, filledLength, bar, PROGRESS_BAR_LENGTH - filledLength, bar2, percent);
+  printf("\r%s: [%.*s%.*s] %.1f%% %.1f kB/s", progress->prefix, filledLength, bar, PROGRESS_BAR_LENGTH - filledLength,
+         bar2, (float)progress->done / progress->total * 100, progress->bytes_per_s / 1000.0);
+  if ((progress->finished == false) && (progress->done > 0))
+    printf(" ETA %.1f s ", progress->eta_ms / 1000.0);
+  else
+    printf("           ");
+  if (progress->retries > 0)
+    printf(" retries %u", progress->retries);
   fflush(stdout);
 
   // Print New Line on Complete
-  if (iteration >= total)
+  if (progress->finished == true)
     printf("\n");
 }
 
-/** \brief Do break in the output
+/** \brief Report progress of the current operation, output is rate limited
+ *
+ * Terminal gets a redrawn bar, other outputs get a parsable line
+ * "PROGRESS prefix done total bytes_per_s eta_ms retries" from time to time,
+ * a callback set for the session gets the same data instead.
+ *
+ * \param [in] done Bytes done, 0 starts a new operation
+ * \param [in] total Total number of bytes
+ * \param [in] prefix Prefix text
+ * \param [in] fill Char to use for filling the bar
+ * \return Noting
+ *
+ */
+void PROGRESS_Print(uint32_t done, uint32_t total, char *prefix, char fill)
+{
+  tProgressState *state = &SESSION_Current->progress;
+  tProgress *progress = &state->progress;
+  uint64_t now = STATS_GetTime();
+  uint64_t elapsed;
+  size_t len;
+
+  if (total == 0)
+    return;
+  if (done == 0)
+  {
+    state->start = now;
+    state->last = 0;
+    state->retries = SESSION_Current->stats.retries;
+    state->tty = (isatty(fileno(stdout)) != 0);
+    // "Writing: " is kept as "Writing"
+    strncpy(progress->prefix, prefix, PROGRESS_PREFIX_LEN - 1);
+    progress->prefix[PROGRESS_PREFIX_LEN - 1] = 0;
+    len = strlen(progress->prefix);
+    while ((len > 0) && ((progress->prefix[len - 1] == ' ') || (progress->prefix[len - 1] == ':')))
+      progress->prefix[--len] = 0;
+  }
+  progress->done = done;
+  progress->total = total;
+  progress->finished = (done >= total);
+  progress->failed = false;
+  // throttle, the first and the last update always go out
+  if ((done > 0) && (progress->finished == false) &&
+      ((now - state->last) < (uint64_t)((state->tty == true) ? PROGRESS_TTY_MS : PROGRESS_LINE_MS) * 1000))
+    return;
+  state->last = now;
+
+  elapsed = now - state->start;
+  progress->bytes_per_s = (elapsed > 0) ? (uint32_t)((uint64_t)done * 1000000 / elapsed) : 0;
+  progress->eta_ms = (done > 0) ? (uint32_t)((uint64_t)(total - done) * elapsed / done / 1000) : 0;
+  progress->retries = SESSION_Current->stats.retries - state->retries;
+
+  if (state->callback != NULL)
+    state->callback(progress, state->arg);
+  else
+  if (state->tty == true)
+    PROGRESS_Bar(progress, fill);
+  else
+    printf("PROGRESS %s %u %u %u %u %u\n", progress->prefix, progress->done, progress->total,
+           progress->bytes_per_s, progress->eta_ms, progress->retries);
+}
+
+/** \brief Do break in the output, the current operation failed
  *
  * \return Nothing
  *
  */
 void PROGRESS_Break(void)
 {
-  printf("\n");
+  tProgressState *state = &SESSION_Current->progress;
+
+  state->progress.finished = true;
+  state->progress.failed = true;
+  if (state->callback != NULL)
+    state->callback(&state->progress, state->arg);
+  else
+  if (state->tty == true)
+    printf("\n");
+}
+
+/** \brief Send progress of the current session to a callback instead of stdout
+ *
+ * \param [in] callback Function to call, NULL returns to stdout
+ * \param [in] arg Argument for the callback
+ * \return Nothing
+ *
+ */
+void PROGRESS_SetCallback(tProgressCallback callback, void *arg)
+{
+  SESSION_Current->progress.callback = callback;
+  SESSION_Current->progress.arg = arg;
 }
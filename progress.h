@@ -3,10 +3,25 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "libupdi.h"
 
 #define PROGRESS_BAR_LENGTH   (20)
+#define PROGRESS_TTY_MS       (100)     // bar redraw interval
+#define PROGRESS_LINE_MS      (1000)    // line interval if output is not a terminal
 
-void PROGRESS_Print(uint16_t iteration, uint16_t total, char *prefix, char fill);
+typedef struct
+{
+  tProgress         progress;
+  tProgressCallback callback;   // replaces terminal output if set
+  void              *arg;
+  uint64_t          start;
+  uint64_t          last;
+  uint32_t          retries;    // session retries at start
+  bool              tty;
+} tProgressState;
+
+void PROGRESS_Print(uint32_t done, uint32_t total, char *prefix, char fill);
 void PROGRESS_Break(void);
+void PROGRESS_SetCallback(tProgressCallback callback, void *arg);
 
 #endif // PROGRESS_H
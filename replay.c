@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "replay.h"
+#include "session.h"
+#include "sleep.h"
+#include "stats.h"
+
+static const char *REPLAY_Names[] = {"write", "read", "open", "close", "break", "unknown"};
+
+/** \brief Load trace and answer all port requests of the current session from it,
+ *         sessions opened later from it share the replay
+ *
+ * \param [in] filename Trace file name
+ * \param [in] scale Timing scale, 0 for no delays, 1 for the recorded timing
+ * \return true if succeed
+ *
+ */
+bool REPLAY_Start(char *filename, float scale)
+{
+  tReplay *replay;
+  tCaptureRecord *records;
+  FILE *fp;
+
+  if ((fp = CAPTURE_OpenTrace(filename)) == NULL)
+    return false;
+  if ((replay = calloc(1, sizeof(tReplay))) == NULL)
+  {
+    fclose(fp);
+    return false;
+  }
+  replay->scale = scale;
+  while (true)
+  {
+    records = realloc(replay->records, (replay->number + 1) * sizeof(tCaptureRecord));
+    if (records == NULL)
+      break;
+    replay->records = records;
+    if (CAPTURE_ReadRecord(fp, &replay->records[replay->number]) == false)
+      break;
+    replay->number++;
+  }
+  fclose(fp);
+  LOG_Print(LOG_LEVEL_INFO, "Replaying %u records from %s", replay->number, filename);
+  replay->mark = STATS_GetTime();
+  SESSION_Current->replay = replay;
+  return true;
+}
+
+/** \brief Finish replay of the current session
+ *
+ * \return true if the session followed the trace to its end
+ *
+ */
+bool REPLAY_Stop(void)
+{
+  tReplay *replay = SESSION_Current->replay;
+  bool res;
+  uint32_t i;
+
+  if (replay == NULL)
+    return true;
+  res = (replay->diverged == false) && (replay->pos == replay->number);
+  if ((replay->diverged == false) && (replay->pos < replay->number))
+    LOG_Print(LOG_LEVEL_ERROR, "Replay stopped at record %u of %u", replay->pos + 1, replay->number);
+  for (i = 0; i < replay->number; i++)
+    free(replay->records[i].data);
+  free(replay->records);
+  free(replay);
+  SESSION_Current->replay = NULL;
+  return res;
+}
+
+/** \brief Print up to 8 bytes as hex text
+ *
+ * \param [out] text Text buffer of 25 chars at least
+ * \param [in] data Data bytes
+ * \param [in] len Length of data
+ * \return text
+ *
+ */
+static char *REPLAY_Hex(char *text, uint8_t *data, uint16_t len)
+{
+  uint16_t i;
+
+  text[0] = 0;
+  for (i = 0; (i < len) && (i < 8); i++)
+    sprintf(&text[i * 3], " %02X", data[i]);
+  return text;
+}
+
+/** \brief Report first difference between the session and the trace,
+ *         everything after it fails
+ *
+ * \param [in] replay Replay state
+ * \param [in] type What the session does
+ * \param [in] data Data written by the session, NULL if none
+ * \param [in] len Length of data
+ * \return Nothing
+ *
+ */
+static void REPLAY_Diverge(tReplay *replay, uint8_t type, uint8_t *data, uint16_t len)
+{
+  tCaptureRecord *record = &replay->records[replay->pos];
+  char expected[3 * 8 + 1];
+  char actual[3 * 8 + 1];
+
+  if (replay->diverged == true)
+    return;
+  replay->diverged = true;
+  if (replay->pos >= replay->number)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Replay diverged: trace has ended, session does %s%s", REPLAY_Names[type],
+              REPLAY_Hex(actual, data, len));
+    return;
+  }
+  LOG_Print(LOG_LEVEL_ERROR, "Replay diverged at record %u of %u: trace has %s%s, session does %s%s",
+            replay->pos + 1, replay->number,
+            REPLAY_Names[(record->type <= CAPTURE_BREAK) ? record->type : CAPTURE_BREAK + 1],
+            REPLAY_Hex(expected, record->data, record->len), REPLAY_Names[type], REPLAY_Hex(actual, data, len));
+}
+
+/** \brief Take next record if it has the wanted type
+ *
+ * \param [in] replay Replay state
+ * \param [in] type Wanted record type
+ * \return record, NULL if replay diverged
+ *
+ */
+static tCaptureRecord *REPLAY_Next(tReplay *replay, uint8_t type)
+{
+  tCaptureRecord *record;
+  uint64_t target;
+
+  if ((replay->diverged == true) || (replay->pos >= replay->number) || (replay->records[replay->pos].type != type))
+    return NULL;
+  record = &replay->records[replay->pos++];
+  // only answers are delayed, the host side takes its own time
+  if ((record->type == CAPTURE_RX) && (replay->scale > 0))
+  {
+    target = replay->mark + (uint64_t)(record->gap * replay->scale);
+    while (STATS_GetTime() + 1000 < target)
+      msleep(1);
+    while (STATS_GetTime() < target);
+  }
+  replay->mark = STATS_GetTime();
+  return record;
+}
+
+/** \brief Replay opening of the port
+ *
+ * \param [in] baudrate Port baudrate
+ * \return true if the trace opened the port at this point
+ *
+ */
+bool REPLAY_Open(uint32_t baudrate)
+{
+  tReplay *replay = SESSION_Current->replay;
+  tCaptureRecord *record = REPLAY_Next(replay, CAPTURE_OPEN);
+
+  if (record == NULL)
+  {
+    REPLAY_Diverge(replay, CAPTURE_OPEN, NULL, 0);
+    return false;
+  }
+  if ((record->len >= 4) && (baudrate != (record->data[0] | (record->data[1] << 8) | (record->data[2] << 16) |
+                                          ((uint32_t)record->data[3] << 24))))
+    LOG_Print(LOG_LEVEL_WARNING, "Trace was recorded at another baudrate");
+  return true;
+}
+
+/** \brief Check written data against the trace
+ *
+ * \param [in] data Data buffer for writing
+ * \param [in] len Length of data buffer
+ * \return 0 if the trace has the same data, -1 if not
+ *
+ */
+int REPLAY_Write(uint8_t *data, uint16_t len)
+{
+  tReplay *replay = SESSION_Current->replay;
+  tCaptureRecord *record;
+
+  if (replay->diverged == true)
+    return -1;
+  record = &replay->records[replay->pos];
+  if ((replay->pos >= replay->number) || (record->type != CAPTURE_TX) || (record->len != len) ||
+      (memcmp(record->data, data, len) != 0))
+  {
+    REPLAY_Diverge(replay, CAPTURE_TX, data, len);
+    return -1;
+  }
+  REPLAY_Next(replay, CAPTURE_TX);
+  return 0;
+}
+
+/** \brief Answer read request with the recorded data
+ *
+ * \param [out] data Data buffer to read data in
+ * \param [in] len Length of data to read
+ * \return number of bytes as int, 0 after divergence
+ *
+ */
+int REPLAY_Read(uint8_t *data, uint16_t len)
+{
+  tReplay *replay = SESSION_Current->replay;
+  tCaptureRecord *record = REPLAY_Next(replay, CAPTURE_RX);
+
+  if (record == NULL)
+  {
+    REPLAY_Diverge(replay, CAPTURE_RX, NULL, 0);
+    return 0;
+  }
+  if (record->len > len)
+  {
+    REPLAY_Diverge(replay, CAPTURE_RX, NULL, 0);
+    return 0;
+  }
+  memcpy(data, record->data, record->len);
+  // short read is followed by the empty timeout record
+  if ((record->len > 0) && (record->len < len))
+    REPLAY_Next(replay, CAPTURE_RX);
+  return record->len;
+}
+
+/** \brief Replay line break, another duration is reported but replayed
+ *
+ * \param [in] duration Break duration in microseconds
+ * \return true if the trace has the break at this point
+ *
+ */
+bool REPLAY_Break(uint32_t duration)
+{
+  tReplay *replay = SESSION_Current->replay;
+  tCaptureRecord *record = REPLAY_Next(replay, CAPTURE_BREAK);
+
+  if (record == NULL)
+  {
+    REPLAY_Diverge(replay, CAPTURE_BREAK, NULL, 0);
+    return false;
+  }
+  if ((record->len >= 4) && (duration != (record->data[0] | (record->data[1] << 8) | (record->data[2] << 16) |
+                                          ((uint32_t)record->data[3] << 24))))
+    LOG_Print(LOG_LEVEL_WARNING, "Trace has a line break of another duration");
+  return true;
+}
+
+/** \brief Replay closing of the port
+ *
+ * \return Nothing
+ *
+ */
+void REPLAY_Close(void)
+{
+  tReplay *replay = SESSION_Current->replay;
+
+  if (REPLAY_Next(replay, CAPTURE_CLOSE) == NULL)
+    REPLAY_Diverge(replay, CAPTURE_CLOSE, NULL, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture.h"
+
+typedef struct
+{
+  tCaptureRecord  *records;
+  uint32_t  number;
+  uint32_t  pos;
+  float     scale;      // 0 answers at once, 1 with the recorded latency
+  uint64_t  mark;       // time when the previous record was replayed
+  bool      diverged;
+} tReplay;
+
+bool REPLAY_Start(char *filename, float scale);
+bool REPLAY_Stop(void);
+bool REPLAY_Open(uint32_t baudrate);
+int REPLAY_Write(uint8_t *data, uint16_t len);
+int REPLAY_Read(uint8_t *data, uint16_t len);
+bool REPLAY_Break(uint32_t duration);
+void REPLAY_Close(void);
+
+#endif
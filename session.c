@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+#include "devices.h"
+#include "capture.h"
+#include "libupdi.h"
+#include "link.h"
+#include "log.h"
+#include "nvm.h"
+#include "phy.h"
+#include "plan.h"
+#include "progress.h"
+#include "replay.h"
+#include "session.h"
+#include "stats.h"
+#include "timing.h"
+
+/**< used until a thread selects its own session, the CLI works with it only */
+static tSession SESSION_Default = {
+  .baudrate = SESSION_BAUDRATE,
+  .device_id = DEVICE_UNKNOWN_ID,
+  .detect = false,
+  .progmode = false,
+  .log_level = LOG_LEVEL_ERROR,
+  .timing.pending = TIMING_NONE
+};
+
+SESSION_THREAD tSession *SESSION_Current = &SESSION_Default;
+
+/** \brief Create a session, open its port and select it for the calling thread
+ *
+ * \param [in] port Port name as string
+ * \param [in] baudrate Port baudrate
+ * \param [in] device Device name
+ * \param [in] connect true to bring up UPDI link, false to open the port only
+ * \return session handle, NULL on error
+ *
+ */
+tSession *SESSION_Open(char *port, uint32_t baudrate, char *device, bool connect)
+{
+  tSession *session;
+  bool res;
+
+  if (strlen(port) >= SESSION_PORT_LEN)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Port name is too long: %s", port);
+    return NULL;
+  }
+  session = malloc(sizeof(tSession));
+  if (session == NULL)
+    return NULL;
+  // new session starts with the settings of the current one
+  *session = *SESSION_Current;
+  strcpy(session->port, port);
+  session->baudrate = baudrate;
+  session->progmode = false;
+  session->read_timeout_us = 0;
+  SESSION_Select(session);
+  STATS_Reset();
+
+  if (SESSION_SetDevice(session, device) == false)
+  {
+    SESSION_Select(NULL);
+    free(session);
+    return NULL;
+  }
+  STATS_Begin("link-init");
+  if (connect == true)
+    res = LINK_Init(port, baudrate, false);
+  else
+    res = PHY_Init(port, baudrate, false);
+  STATS_End();
+  if (res == false)
+  {
+    SESSION_Close(session);
+    return NULL;
+  }
+
+  return session;
+}
+
+/** \brief Close session port and release the session
+ *
+ * \param [in] session Session handle
+ * \return Nothing
+ *
+ */
+void SESSION_Close(tSession *session)
+{
+  if (session == NULL)
+    return;
+  SESSION_Select(session);
+  PHY_Close();
+  SESSION_Select(NULL);
+  free(session);
+}
+
+/** \brief Select session for all following calls of the calling thread
+ *
+ * \param [in] session Session handle, NULL selects the default session
+ * \return Nothing
+ *
+ */
+void SESSION_Select(tSession *session)
+{
+  if (session == NULL)
+    SESSION_Current = &SESSION_Default;
+  else
+    SESSION_Current = session;
+}
+
+/** \brief Set device type of the session
+ *
+ * \param [in] session Session handle
+ * \param [in] device Device name, "auto" to detect it on every target
+ * \return true if device type is known
+ *
+ */
+bool SESSION_SetDevice(tSession *session, char *device)
+{
+  int8_t id;
+
+  SESSION_Select(session);
+  id = DEVICES_GetId(device);
+  session->detect = (id == DEVICE_AUTO_ID);
+  if ((id < 0) && (session->detect == false))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Wrong or unsupported device type: %s", device);
+    return false;
+  }
+  return true;
+}
+
+/** \brief Set log level of the session
+ *
+ * \param [in] session Session handle
+ * \param [in] level Lowest level printed (LOG_LEVEL_xxx)
+ * \return Nothing
+ *
+ */
+void SESSION_SetLogLevel(tSession *session, uint8_t level)
+{
+  SESSION_Select(session);
+  LOG_SetLevel(level);
+}
+
+/** \brief Set progress callback of the session, it replaces the terminal output
+ *
+ * \param [in] session Session handle
+ * \param [in] callback Callback, NULL for the terminal output
+ * \param [in] arg Argument passed to the callback
+ * \return Nothing
+ *
+ */
+void SESSION_SetProgressCallback(tSession *session, tProgressCallback callback, void *arg)
+{
+  SESSION_Select(session);
+  PROGRESS_SetCallback(callback, arg);
+}
+
+/** \brief Bring up UPDI link again on the opened port, e.g. for a new target
+ *
+ * \param [in] session Session handle
+ * \return true if succeed
+ *
+ */
+bool SESSION_Connect(tSession *session)
+{
+  bool res;
+
+  SESSION_Select(session);
+  STATS_Begin("link-init");
+  res = LINK_Connect(session->port, session->baudrate);
+  STATS_End();
+  return res;
+}
+
+/** \brief Check if a target answers on the session port
+ *
+ * \param [in] session Session handle
+ * \return true if target is present
+ *
+ */
+bool SESSION_Probe(tSession *session)
+{
+  SESSION_Select(session);
+  return LINK_Probe();
+}
+
+/** \brief Execute plan in the session
+ *
+ * \param [in] session Session handle
+ * \param [in] plan Plan to execute
+ * \return true if all steps succeed
+ *
+ */
+bool SESSION_Execute(tSession *session, tPlan *plan)
+{
+  SESSION_Select(session);
+  return PLAN_Execute(plan);
+}
+
+/** \brief Clear statistics of the session and start a new run
+ *
+ * \param [in] session Session handle
+ * \return Nothing
+ *
+ */
+void SESSION_ResetStats(tSession *session)
+{
+  SESSION_Select(session);
+  STATS_Reset();
+}
+
+/** \brief Print statistics of the session run as one JSON record
+ *
+ * \param [in] session Session handle
+ * \param [in] fp File handle to print to
+ * \param [in] result Result of the run
+ * \return Nothing
+ *
+ */
+void SESSION_PrintStats(tSession *session, FILE *fp, bool result)
+{
+  SESSION_Select(session);
+  STATS_PrintJson(fp, result);
+}
+
+/** \brief Load learned NVM timing into the session
+ *
+ * \param [in] session Session handle, NULL for the default one copied to sessions opened later
+ * \param [in] filename Profile file name
+ * \return true if the profile is loaded
+ *
+ */
+bool SESSION_LoadTiming(tSession *session, char *filename)
+{
+  SESSION_Select(session);
+  return TIMING_Load(filename);
+}
+
+/** \brief Save NVM timing learned by the session
+ *
+ * \param [in] session Session handle, NULL for the default one
+ * \param [in] filename Profile file name
+ * \return true if the profile is saved
+ *
+ */
+bool SESSION_SaveTiming(tSession *session, char *filename)
+{
+  SESSION_Select(session);
+  return TIMING_Save(filename);
+}
+
+/** \brief Load progress of an interrupted flash write, the next write resumes it
+ *
+ * \param [in] session Session handle
+ * \param [in] filename Checkpoint file name
+ * \return true if a checkpoint is loaded
+ *
+ */
+bool SESSION_LoadCheckpoint(tSession *session, char *filename)
+{
+  SESSION_Select(session);
+  return NVM_LoadCheckpoint(filename);
+}
+
+/** \brief Save checkpoint of an interrupted write of the session, the file is removed if there is none
+ *
+ * \param [in] session Session handle
+ * \param [in] filename Checkpoint file name
+ * \return true if succeed
+ *
+ */
+bool SESSION_SaveCheckpoint(tSession *session, char *filename)
+{
+  SESSION_Select(session);
+  return NVM_SaveCheckpoint(filename);
+}
+
+/** \brief Record all port traffic of the session to a trace file
+ *
+ * \param [in] session Session handle, NULL for the default one, sessions opened later share its trace
+ * \param [in] filename Trace file name
+ * \return true if the trace is created
+ *
+ */
+bool SESSION_StartCapture(tSession *session, char *filename)
+{
+  SESSION_Select(session);
+  return CAPTURE_Start(filename);
+}
+
+/** \brief Stop recording and close the trace file
+ *
+ * \param [in] session Session handle, NULL for the default one
+ * \return Nothing
+ *
+ */
+void SESSION_StopCapture(tSession *session)
+{
+  SESSION_Select(session);
+  CAPTURE_Stop();
+}
+
+/** \brief Answer port traffic of the session from a recorded trace
+ *
+ * \param [in] session Session handle, NULL for the default one, sessions opened later share its trace
+ * \param [in] filename Trace file name
+ * \param [in] scale Timing scale, 0 answers at once, 1 with the recorded latency
+ * \return true if the trace is loaded
+ *
+ */
+bool SESSION_StartReplay(tSession *session, char *filename, float scale)
+{
+  SESSION_Select(session);
+  return REPLAY_Start(filename, scale);
+}
+
+/** \brief Stop the replay and release the trace
+ *
+ * \param [in] session Session handle, NULL for the default one
+ * \return true if the session followed the trace to its end
+ *
+ */
+bool SESSION_StopReplay(tSession *session)
+{
+  SESSION_Select(session);
+  return REPLAY_Stop();
+}
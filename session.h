@@ -0,0 +1,50 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "nvm.h"
+#include "progress.h"
+#include "replay.h"
+#include "stats.h"
+#include "timing.h"
+
+#define SESSION_THREAD      __thread
+#define SESSION_PORT_LEN    (32)
+
+#ifndef SESSION_TYPEDEF
+#define SESSION_TYPEDEF
+typedef struct tSession tSession;
+#endif
+
+/**< all state of one programming session, private to the library */
+struct tSession
+{
+  #ifdef __MINGW32__
+  HANDLE    hSerial;
+  #endif
+  #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+  int       fd;
+  #endif
+  char      port[SESSION_PORT_LEN];
+  uint32_t  baudrate;
+  int8_t    device_id;
+  bool      detect;       // device type is detected on every target
+  bool      progmode;
+  uint32_t  read_timeout_us;  // 0 for the timeout of the port settings
+  uint8_t   log_level;
+  tStats    stats;
+  tNvmCheckpoint checkpoint;  // kept while the session lives
+  tTiming   timing;
+  tProgressState progress;
+  tCapture  *capture;     // shared by the sessions opened from the capturing one
+  tReplay   *replay;      // port is simulated from a trace if set
+};
+
+extern SESSION_THREAD tSession *SESSION_Current;
+
+#endif
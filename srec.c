@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include "srec.h"
+#include "session.h"
+
+static SESSION_THREAD uint8_t crc;
+
+/** \brief Convert byte to string with HEX representation
+ *
+ * \param [in] byte One byte of data
+ * \return HEX representation as string
+ *
+ */
+static char* SREC_AddByte(uint8_t byte)
+{
+  static SESSION_THREAD char res[3];
+
+  crc += byte;
+  uint8_t n = (byte & 0xF0U) >> 4; // high nybble
+  res[0] = SREC_DIGIT(n);
+  n = byte & 0x0FU; // low nybble
+  res[1] = SREC_DIGIT(n);
+  res[2] = 0;
+
+  return res;
+}
+
+/** \brief Write one S-record to a file
+ *
+ * \param [in] fp File handle
+ * \param [in] type Record type
+ * \param [in] address Record address (16 bits)
+ * \param [in] data Record data
+ * \param [in] len Length of record data
+ * \return Nothing
+ *
+ */
+static void SREC_WriteRecord(FILE *fp, uint8_t type, uint16_t address, uint8_t *data, uint8_t len)
+{
+  uint8_t x;
+  char str[128];
+
+  crc = 0;
+  str[0] = SREC_START;
+  str[1] = SREC_DIGIT(type);
+  str[2] = 0;
+  // write count: address, data and checksum
+  strcat(str, SREC_AddByte(len + 3));
+  // write address
+  strcat(str, SREC_AddByte((uint8_t)(address >> 8)));
+  strcat(str, SREC_AddByte((uint8_t)address));
+  for (x = 0; x < len; x++)
+  {
+    strcat(str, SREC_AddByte(data[x]));
+  }
+  strcat(str, SREC_AddByte((uint8_t)~crc));
+  strcat(str, SREC_NEWLINE);
+  fwrite(str, strlen(str), 1, fp);
+}
+
+/** \brief Write data buffer to S-record file
+ *
+ * \param [in] fp File handle
+ * \param [in] data Data buffer to write
+ * \param [in] len Length of data buffer
+ * \return error code as uint8_t
+ *
+ */
+uint8_t SREC_WriteFile(FILE *fp, uint8_t *data, uint16_t len)
+{
+  uint16_t i;
+  uint16_t records;
+  uint8_t width;
+
+  SREC_WriteRecord(fp, SREC_HEADER_RECORD, 0, (uint8_t*)SREC_HEADER, strlen(SREC_HEADER));
+  records = 0;
+  for (i = 0; i < len; i += SREC_LINE_LENGTH)
+  {
+    if (len - i >= SREC_LINE_LENGTH)
+      width = SREC_LINE_LENGTH;
+    else
+      width = (uint8_t)(len - i);
+    SREC_WriteRecord(fp, SREC_DATA16_RECORD, i, &data[i], width);
+    records++;
+  }
+  SREC_WriteRecord(fp, SREC_COUNT16_RECORD, records, NULL, 0);
+  SREC_WriteRecord(fp, SREC_START16_RECORD, 0, NULL, 0);
+
+  return SREC_ERROR_NONE;
+}
+
+/** \brief Get one nibble from char
+ *
+ * \param [in] c Char value
+ * \return data nibble as uint8_t
+ *
+ */
+static uint8_t SREC_GetNibble(char c)
+{
+  if (c >= '0' && c <= '9')
+    return (uint8_t)(c - '0');
+  else if (c >= 'A' && c <= 'F')
+    return (uint8_t)(c - 'A' + 10);
+  else if (c >= 'a' && c <= 'f')
+    return (uint8_t)(c - 'a' + 10);
+  else
+    return 0;
+}
+
+/** \brief Get full byte from two chars
+ *
+ * \param [in] data Two chars as HEX representation
+ * \return byte value as uint8_t
+ *
+ */
+static uint8_t SREC_GetByte(char *data)
+{
+  uint8_t res = SREC_GetNibble(*data++) << 4;
+  res += SREC_GetNibble(*data);
+  crc += res;
+  return res;
+}
+
+/** \brief Read Motorola S-record file to a binary memory buffer
+ *
+ * \param [in] fp File handler
+ * \param [out] data Data buffer to read data into
+ * \param [in] maxlen Maximal data length
+ * \param [out] min_addr Minimal address with non-empty data
+ * \param [out] max_addr Maximal address with non-empty data
+ * \return error code as uint8_t
+ *
+ */
+uint8_t SREC_ReadFile(FILE *fp, uint8_t *data, uint16_t maxlen,
+                      uint16_t *min_addr, uint16_t *max_addr)
+{
+  uint32_t addr;
+  uint8_t count;
+  uint8_t type;
+  uint8_t addr_len;
+  uint8_t i;
+  uint8_t byte;
+  char str[600];
+  char *end;
+
+  while (!feof(fp))
+  {
+    if (fgets(str, sizeof(str), fp) == NULL)
+    {
+      if (feof(fp))
+        break;
+      return SREC_ERROR_FILE;
+    }
+    // trim whitespace on the right
+    end = str + strlen(str) - 1;
+    while (end >= str && isspace((unsigned char) *end)) end--;
+    end[1] = '\0';
+    if (strlen(str) == 0)
+      continue;
+    if ((strlen(str) < SREC_MIN_STRING) || (str[0] != SREC_START) || !isdigit((unsigned char)str[SREC_OFFS_TYPE]))
+      return SREC_ERROR_FMT;
+    type = (uint8_t)(str[SREC_OFFS_TYPE] - '0');
+    crc = 0;
+    count = SREC_GetByte(&str[SREC_OFFS_COUNT]);
+    if ((size_t)(count * 2 + SREC_OFFS_ADDR) != strlen(str))
+      return SREC_ERROR_FMT;
+    switch (type)
+    {
+      case SREC_HEADER_RECORD:
+      case SREC_DATA16_RECORD:
+      case SREC_COUNT16_RECORD:
+      case SREC_START16_RECORD:
+        addr_len = 2;
+        break;
+      case SREC_DATA24_RECORD:
+      case SREC_COUNT24_RECORD:
+      case SREC_START24_RECORD:
+        addr_len = 3;
+        break;
+      case SREC_DATA32_RECORD:
+      case SREC_START32_RECORD:
+        addr_len = 4;
+        break;
+      default:
+        return SREC_ERROR_FMT;
+    }
+    if (count < addr_len + 1)
+      return SREC_ERROR_FMT;
+    addr = 0;
+    for (i = 0; i < addr_len; i++)
+      addr = (addr << 8) + SREC_GetByte(&str[SREC_OFFS_ADDR + i * 2]);
+    // verify checksum over the whole record first
+    for (i = addr_len; i < count; i++)
+      SREC_GetByte(&str[SREC_OFFS_ADDR + i * 2]);
+    if (crc != 0xFF)
+      return SREC_ERROR_CRC;
+    switch (type)
+    {
+      case SREC_DATA16_RECORD:
+      case SREC_DATA24_RECORD:
+      case SREC_DATA32_RECORD:
+        for (i = 0; i < count - addr_len - 1; i++)
+        {
+          if (addr + i >= maxlen)
+            return SREC_ERROR_SIZE;
+          byte = SREC_GetByte(&str[SREC_OFFS_ADDR + (addr_len + i) * 2]);
+          if (byte != 0xFF)
+          {
+            *max_addr = addr + i + 1;
+            if ((addr + i) < *min_addr)
+              *min_addr = (addr + i);
+          }
+          data[addr + i] = byte;
+        }
+        break;
+      case SREC_START32_RECORD:
+      case SREC_START24_RECORD:
+      case SREC_START16_RECORD:
+        return SREC_ERROR_NONE;
+      default:
+        break;
+    }
+  }
+
+  return SREC_ERROR_NONE;
+}
@@ -0,0 +1,46 @@
+#ifndef SREC_H
+#define SREC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#define SREC_LINE_LENGTH    16
+#define SREC_MIN_STRING     10
+
+#define SREC_OFFS_TYPE      1
+#define SREC_OFFS_COUNT     2
+#define SREC_OFFS_ADDR      4
+
+#define SREC_START          'S'
+#define SREC_NEWLINE        "\n"
+#define SREC_HEADER         "updiprog"
+
+enum {
+  SREC_HEADER_RECORD,
+  SREC_DATA16_RECORD,
+  SREC_DATA24_RECORD,
+  SREC_DATA32_RECORD,
+  SREC_RESERVED_RECORD,
+  SREC_COUNT16_RECORD,
+  SREC_COUNT24_RECORD,
+  SREC_START32_RECORD,
+  SREC_START24_RECORD,
+  SREC_START16_RECORD
+};
+
+enum {
+  SREC_ERROR_NONE,
+  SREC_ERROR_FILE,
+  SREC_ERROR_SIZE,
+  SREC_ERROR_FMT,
+  SREC_ERROR_CRC
+};
+
+#define SREC_DIGIT(n) ((char)((n) + (((n) < 10) ? '0' : ('A' - 10))))
+
+uint8_t SREC_WriteFile(FILE *fp, uint8_t *data, uint16_t len);
+uint8_t SREC_ReadFile(FILE *fp, uint8_t *data, uint16_t maxlen,
+                      uint16_t *min_addr, uint16_t *max_addr);
+
+#endif
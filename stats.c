@@ -0,0 +1,281 @@
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+#include <time.h>
+#endif
+#include <string.h>
+#include "devices.h"
+#include "session.h"
+#include "stats.h"
+
+/** \brief Get monotonic time
+ *
+ * \return time in microseconds as uint64_t
+ *
+ */
+uint64_t STATS_GetTime(void)
+{
+  #ifdef __MINGW32__
+  LARGE_INTEGER count;
+  LARGE_INTEGER freq;
+
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t)(count.QuadPart / freq.QuadPart * 1000000 +
+                    count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+  #endif // __MINGW32__
+  #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__linux)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  #endif // __linux
+}
+
+/** \brief Clear statistics of the current session and start a new run
+ *
+ * \return Nothing
+ *
+ */
+void STATS_Reset(void)
+{
+  tStats *stats = &SESSION_Current->stats;
+
+  memset(stats, 0, sizeof(tStats));
+  stats->run_start = STATS_GetTime();
+}
+
+/** \brief Start timing of a new phase, the previous one is finished
+ *
+ * \param [in] name Phase name
+ * \return Nothing
+ *
+ */
+void STATS_Begin(char *name)
+{
+  tStats *stats = &SESSION_Current->stats;
+  tStatsPhase *phase;
+
+  STATS_End();
+  if (stats->number >= STATS_MAX_PHASES)
+    return;
+  phase = &stats->phases[stats->number];
+  strncpy(phase->name, name, STATS_NAME_LEN);
+  phase->name[STATS_NAME_LEN - 1] = 0;
+  // counters at start, turned into differences at the end
+  phase->bytes = stats->bytes;
+  phase->frames = stats->frames;
+  phase->retries = stats->retries;
+  stats->active = true;
+  stats->phase_start = STATS_GetTime();
+}
+
+/** \brief Finish timing of the current phase
+ *
+ * \return Nothing
+ *
+ */
+void STATS_End(void)
+{
+  tStats *stats = &SESSION_Current->stats;
+  tStatsPhase *phase;
+
+  if (stats->active == false)
+    return;
+  phase = &stats->phases[stats->number];
+  phase->time_us = (uint32_t)(STATS_GetTime() - stats->phase_start);
+  phase->bytes = stats->bytes - phase->bytes;
+  phase->frames = stats->frames - phase->frames;
+  phase->retries = stats->retries - phase->retries;
+  stats->number++;
+  stats->active = false;
+}
+
+/** \brief Count payload bytes read from or written to the memory
+ *
+ * \param [in] len Number of bytes
+ * \return Nothing
+ *
+ */
+void STATS_AddBytes(uint32_t len)
+{
+  SESSION_Current->stats.bytes += len;
+}
+
+/** \brief Count bytes sent to the port
+ *
+ * \param [in] len Number of bytes
+ * \return Nothing
+ *
+ */
+void STATS_AddTx(uint16_t len)
+{
+  SESSION_Current->stats.bytes_tx += len;
+}
+
+/** \brief Count bytes received from the target
+ *
+ * \param [in] len Number of bytes
+ * \return Nothing
+ *
+ */
+void STATS_AddRx(uint16_t len)
+{
+  SESSION_Current->stats.bytes_rx += len;
+}
+
+/** \brief Count UPDI frame
+ *
+ * \return Nothing
+ *
+ */
+void STATS_AddFrame(void)
+{
+  SESSION_Current->stats.frames++;
+}
+
+/** \brief Count missing or wrong ACK
+ *
+ * \return Nothing
+ *
+ */
+void STATS_AddAckFailure(void)
+{
+  SESSION_Current->stats.ack_failures++;
+}
+
+/** \brief Count retry of a failed burst or page
+ *
+ * \return Nothing
+ *
+ */
+void STATS_AddRetry(void)
+{
+  SESSION_Current->stats.retries++;
+}
+
+/** \brief Count completion time of NVM operation
+ *
+ * \param [in] op Operation
+ * \param [in] time_us Time from command to ready status in microseconds
+ * \return Nothing
+ *
+ */
+void STATS_AddNvmTime(uint8_t op, uint32_t time_us)
+{
+  tStatsNvm *nvm = &SESSION_Current->stats.nvm[op];
+  uint8_t bucket = 0;
+
+  if ((nvm->count == 0) || (time_us < nvm->min_us))
+    nvm->min_us = time_us;
+  if (time_us > nvm->max_us)
+    nvm->max_us = time_us;
+  nvm->count++;
+  nvm->sum_us += time_us;
+  while ((time_us >>= 1) != 0)
+    bucket++;
+  if (bucket >= STATS_HIST_LEN)
+    bucket = STATS_HIST_LEN - 1;
+  nvm->hist[bucket]++;
+}
+
+/** \brief Note that programming mode is reached, only the first time counts
+ *
+ * \return time from port open to programming mode in microseconds as uint32_t
+ *
+ */
+uint32_t STATS_Connected(void)
+{
+  tStats *stats = &SESSION_Current->stats;
+
+  if (stats->connect_us == 0)
+    stats->connect_us = (uint32_t)(STATS_GetTime() - stats->run_start);
+  return stats->connect_us;
+}
+
+/** \brief Calculate rate per second
+ *
+ * \param [in] value Amount
+ * \param [in] time_us Time in microseconds
+ * \return rate as uint32_t, 0 if no time passed
+ *
+ */
+static uint32_t STATS_Rate(uint64_t value, uint64_t time_us)
+{
+  if (time_us == 0)
+    return 0;
+  return (uint32_t)(value * 1000000 / time_us);
+}
+
+/** \brief Print completion times of the NVM operations as JSON array items
+ *
+ * Bucket i of the histogram counts times from 2^i to 2^(i+1) - 1 us,
+ * it is cut after the last used bucket.
+ *
+ * \param [in] fp File handle to print to
+ * \return Nothing
+ *
+ */
+static void STATS_PrintNvmJson(FILE *fp)
+{
+  tStatsNvm *nvm;
+  bool first = true;
+  uint8_t op;
+  uint8_t last;
+  uint8_t i;
+
+  for (op = 0; op < TIMING_OPS; op++)
+  {
+    nvm = &SESSION_Current->stats.nvm[op];
+    if (nvm->count == 0)
+      continue;
+    fprintf(fp, "%s{\"op\":\"%s\",\"count\":%u,\"min_us\":%u,\"mean_us\":%u,\"max_us\":%u,\"expected_us\":%u,"
+            "\"hist_log2_us\":[", (first == true) ? "" : ",", TIMING_GetName(op), nvm->count, nvm->min_us,
+            (uint32_t)(nvm->sum_us / nvm->count), nvm->max_us, TIMING_Expected(op));
+    for (last = STATS_HIST_LEN - 1; (last > 0) && (nvm->hist[last] == 0); last--)
+      ;
+    for (i = 0; i <= last; i++)
+      fprintf(fp, "%s%u", (i > 0) ? "," : "", nvm->hist[i]);
+    fprintf(fp, "]}");
+    first = false;
+  }
+}
+
+/** \brief Print statistics of the run as one JSON record
+ *
+ * \param [in] fp File handle to print to
+ * \param [in] result Result of the run
+ * \return Nothing
+ *
+ */
+void STATS_PrintJson(FILE *fp, bool result)
+{
+  tStats *stats = &SESSION_Current->stats;
+  tStatsPhase *phase;
+  uint64_t total;
+  uint8_t i;
+
+  STATS_End();
+  total = STATS_GetTime() - stats->run_start;
+  fprintf(fp, "{\"result\":\"%s\",\"device\":\"%s\",\"baudrate\":%u,\"time_ms\":%.3f,\"connect_ms\":%.3f,"
+          "\"phases\":[",
+          (result == true) ? "pass" : "fail",
+          (SESSION_Current->device_id < 0) ? "" : DEVICES_GetNameByNumber(SESSION_Current->device_id),
+          SESSION_Current->baudrate, total / 1000.0, stats->connect_us / 1000.0);
+  for (i = 0; i < stats->number; i++)
+  {
+    phase = &stats->phases[i];
+    fprintf(fp, "%s{\"name\":\"%s\",\"time_ms\":%.3f,\"bytes\":%u,\"frames\":%u,\"retries\":%u,\"bytes_per_s\":%u}",
+            (i > 0) ? "," : "", phase->name, phase->time_us / 1000.0, phase->bytes, phase->frames,
+            phase->retries, STATS_Rate(phase->bytes, phase->time_us));
+  }
+  fprintf(fp, "],\"nvm_timing\":[");
+  STATS_PrintNvmJson(fp);
+  fprintf(fp, "],\"bytes\":%u,\"bytes_tx\":%u,\"bytes_rx\":%u,\"frames\":%u,\"ack_failures\":%u,"
+          "\"retries\":%u,\"effective_baud\":%u,\"bytes_per_s\":%u}\n",
+          stats->bytes, stats->bytes_tx, stats->bytes_rx, stats->frames, stats->ack_failures, stats->retries,
+          STATS_Rate((uint64_t)(stats->bytes_tx + stats->bytes_rx) * STATS_BITS_PER_BYTE, total),
+          STATS_Rate(stats->bytes, total));
+  fflush(fp);
+}
@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "timing.h"
+
+#define STATS_MAX_PHASES    (40)
+#define STATS_NAME_LEN      (24)
+#define STATS_BITS_PER_BYTE (12)    // start bit, 8 data bits, parity and 2 stop bits
+#define STATS_HIST_LEN      (24)    // log2 buckets of microseconds, up to 16 s
+
+typedef struct
+{
+  char      name[STATS_NAME_LEN];
+  uint32_t  time_us;
+  uint32_t  bytes;
+  uint32_t  frames;
+  uint32_t  retries;
+} tStatsPhase;
+
+/**< completion times of one NVM operation */
+typedef struct
+{
+  uint32_t  count;
+  uint32_t  min_us;
+  uint32_t  max_us;
+  uint64_t  sum_us;
+  uint32_t  hist[STATS_HIST_LEN];
+} tStatsNvm;
+
+typedef struct
+{
+  tStatsPhase phases[STATS_MAX_PHASES];
+  uint8_t   number;
+  bool      active;
+  uint64_t  run_start;
+  uint64_t  phase_start;
+  uint32_t  connect_us;   // from port open to programming mode
+  uint32_t  bytes;
+  uint32_t  bytes_tx;
+  uint32_t  bytes_rx;
+  uint32_t  frames;
+  uint32_t  ack_failures;
+  uint32_t  retries;
+  tStatsNvm nvm[TIMING_OPS];
+} tStats;
+
+uint64_t STATS_GetTime(void);
+void STATS_Reset(void);
+void STATS_Begin(char *name);
+void STATS_End(void);
+void STATS_AddBytes(uint32_t len);
+void STATS_AddTx(uint16_t len);
+void STATS_AddRx(uint16_t len);
+void STATS_AddFrame(void);
+void STATS_AddAckFailure(void);
+void STATS_AddRetry(void);
+void STATS_AddNvmTime(uint8_t op, uint32_t time_us);
+uint32_t STATS_Connected(void);
+void STATS_PrintJson(FILE *fp, bool result);
+
+#endif
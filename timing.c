@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <string.h>
+#include "devices.h"
+#include "log.h"
+#include "session.h"
+#include "stats.h"
+#include "timing.h"
+#include "updi.h"
+
+static char *TIMING_Names[TIMING_OPS] = {
+  "page-write",
+  "page-erase",
+  "page-erase-write",
+  "eeprom-write",
+  "eeprom-erase",
+  "chip-erase",
+  "fuse-write"
+};
+
+/** \brief Get profile key of the current target
+ *
+ * \return signature as hex if it was read, device name otherwise, NULL if target is unknown
+ *
+ */
+static char *TIMING_Key(void)
+{
+  tTiming *timing = &SESSION_Current->timing;
+
+  if (timing->key[0] != 0)
+    return timing->key;
+  if (SESSION_Current->device_id < 0)
+    return NULL;
+  return DEVICES_GetName();
+}
+
+/** \brief Find profile entry of the operation
+ *
+ * \param [in] key Target key
+ * \param [in] op Operation
+ * \param [in] create true to add the entry if it is missing
+ * \return entry, NULL if not found or no room left
+ *
+ */
+static tTimingEntry *TIMING_Find(char *key, uint8_t op, bool create)
+{
+  tTiming *timing = &SESSION_Current->timing;
+  tTimingEntry *entry;
+  uint8_t i;
+
+  for (i = 0; i < timing->number; i++)
+  {
+    entry = &timing->entries[i];
+    if ((entry->op == op) && (strcmp(entry->key, key) == 0))
+      return entry;
+  }
+  if ((create == false) || (timing->number >= TIMING_MAX_ENTRIES))
+    return NULL;
+  entry = &timing->entries[timing->number++];
+  strncpy(entry->key, key, TIMING_KEY_LEN);
+  entry->key[TIMING_KEY_LEN - 1] = 0;
+  entry->op = op;
+  entry->estimate_us = 0;
+  entry->samples = 0;
+  return entry;
+}
+
+/** \brief Set signature of the current target, profile entries are kept per signature
+ *
+ * \param [in] signature Signature bytes, NULL if it can't be read
+ * \return Nothing
+ *
+ */
+void TIMING_SetSignature(uint8_t *signature)
+{
+  tTiming *timing = &SESSION_Current->timing;
+
+  if (signature == NULL)
+    timing->key[0] = 0;
+  else
+    snprintf(timing->key, TIMING_KEY_LEN, "%02X%02X%02X", signature[0], signature[1], signature[2]);
+}
+
+/** \brief Get operation timed for NVM controller command
+ *
+ * \param [in] command NVM controller command
+ * \return operation, TIMING_NONE if the command completes at once
+ *
+ */
+uint8_t TIMING_GetOperation(uint8_t command)
+{
+  switch (command)
+  {
+    case UPDI_NVMCTRL_CTRLA_WRITE_PAGE:
+      return TIMING_PAGE_WRITE;
+    case UPDI_NVMCTRL_CTRLA_ERASE_PAGE:
+      return TIMING_PAGE_ERASE;
+    case UPDI_NVMCTRL_CTRLA_ERASE_WRITE_PAGE:
+      return TIMING_PAGE_ERASE_WRITE;
+    case UPDI_NVMCTRL_CTRLA_CHIP_ERASE:
+      return TIMING_CHIP_ERASE;
+    case UPDI_NVMCTRL_CTRLA_ERASE_EEPROM:
+      return TIMING_EEPROM_ERASE;
+    case UPDI_NVMCTRL_CTRLA_WRITE_FUSE:
+      return TIMING_FUSE_WRITE;
+    default:
+      return TIMING_NONE;
+  }
+}
+
+/** \brief Get name of the operation
+ *
+ * \param [in] op Operation
+ * \return name as string
+ *
+ */
+char *TIMING_GetName(uint8_t op)
+{
+  if (op >= TIMING_OPS)
+    return "unknown";
+  return TIMING_Names[op];
+}
+
+/** \brief Note start of the operation, it is finished by TIMING_Finish
+ *
+ * \param [in] op Operation, TIMING_NONE if nothing to time
+ * \return Nothing
+ *
+ */
+void TIMING_Start(uint8_t op)
+{
+  tTiming *timing = &SESSION_Current->timing;
+
+  timing->pending = op;
+  timing->start = STATS_GetTime();
+}
+
+/** \brief Get expected completion time of the operation on the current target
+ *
+ * \param [in] op Operation
+ * \return time in microseconds as uint32_t, 0 if unknown
+ *
+ */
+uint32_t TIMING_Expected(uint8_t op)
+{
+  tTimingEntry *entry;
+  char *key = TIMING_Key();
+
+  if ((key != NULL) && ((entry = TIMING_Find(key, op, false)) != NULL) && (entry->samples > 0))
+    return entry->estimate_us;
+  // nothing learned yet, datasheet values if the device definition has them
+  switch (op)
+  {
+    case TIMING_PAGE_WRITE:
+    case TIMING_PAGE_ERASE:
+      return DEVICES_GetPageWriteTime() * 1000;
+    case TIMING_PAGE_ERASE_WRITE:
+      return DEVICES_GetPageWriteTime() * 2000;
+    case TIMING_CHIP_ERASE:
+      return DEVICES_GetChipEraseTime() * 1000;
+    default:
+      return 0;
+  }
+}
+
+/** \brief Schedule status polls for the running operation
+ *
+ * \param [out] interval Time between the polls in microseconds
+ * \return time of the first poll, 0 to poll at once
+ *
+ */
+uint64_t TIMING_Schedule(uint32_t *interval)
+{
+  tTiming *timing = &SESSION_Current->timing;
+  uint32_t expected = 0;
+
+  if (timing->pending != TIMING_NONE)
+    expected = TIMING_Expected(timing->pending);
+  if (expected == 0)
+  {
+    // unknown time, poll every millisecond as before
+    *interval = 1000;
+    return 0;
+  }
+  *interval = expected / TIMING_POLLS;
+  return timing->start + (uint64_t)expected * TIMING_FIRST_POLL / 4;
+}
+
+/** \brief Finish the running operation, its time goes to the profile and the statistics
+ *
+ * \param [in] done true if the operation completed, false if it failed or timed out
+ * \return Nothing
+ *
+ */
+void TIMING_Finish(bool done)
+{
+  tTiming *timing = &SESSION_Current->timing;
+  tTimingEntry *entry;
+  uint32_t elapsed;
+  uint32_t sample;
+  char *key;
+
+  if (timing->pending == TIMING_NONE)
+    return;
+  elapsed = (uint32_t)(STATS_GetTime() - timing->start);
+  // replayed traces have no real timing to learn from
+  if ((done == true) && (SESSION_Current->replay == NULL))
+  {
+    STATS_AddNvmTime(timing->pending, elapsed);
+    key = TIMING_Key();
+    if ((key != NULL) && ((entry = TIMING_Find(key, timing->pending, true)) != NULL))
+    {
+      // a single stall of the host must not spoil the estimate
+      sample = elapsed;
+      if ((entry->samples > 0) && (sample > TIMING_MAX_STEP * entry->estimate_us))
+        sample = TIMING_MAX_STEP * entry->estimate_us;
+      if (entry->samples == 0)
+        entry->estimate_us = sample;
+      else
+        entry->estimate_us += ((int64_t)sample - entry->estimate_us) / TIMING_WEIGHT;
+      entry->samples++;
+    }
+  }
+  timing->pending = TIMING_NONE;
+}
+
+/** \brief Load timing profile, entries replace the learned ones
+ *
+ * \param [in] filename Profile file name
+ * \return true if succeed
+ *
+ */
+bool TIMING_Load(char *filename)
+{
+  tTimingEntry *entry;
+  char line[TIMING_LINE_LEN];
+  char key[TIMING_KEY_LEN];
+  char name[TIMING_LINE_LEN];
+  unsigned int estimate, samples;
+  uint16_t number = 0;
+  uint8_t op;
+  FILE *fp;
+
+  // missing profile is fine, it is written after the first run
+  if ((fp = fopen(filename, "r")) == NULL)
+    return false;
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    number++;
+    if ((line[0] == '#') || (line[0] == '\r') || (line[0] == '\n'))
+      continue;
+    if (sscanf(line, "nvm-timing %15s %127s %u %u", key, name, &estimate, &samples) != 4)
+    {
+      LOG_Print(LOG_LEVEL_WARNING, "%s:%d: wrong timing line", filename, number);
+      continue;
+    }
+    for (op = 0; op < TIMING_OPS; op++)
+    {
+      if (strcmp(name, TIMING_Names[op]) == 0)
+        break;
+    }
+    if ((op == TIMING_OPS) || ((entry = TIMING_Find(key, op, true)) == NULL))
+    {
+      LOG_Print(LOG_LEVEL_WARNING, "%s:%d: timing of %s is skipped", filename, number, name);
+      continue;
+    }
+    entry->estimate_us = estimate;
+    entry->samples = samples;
+  }
+  fclose(fp);
+  return true;
+}
+
+/** \brief Save timing profile
+ *
+ * \param [in] filename Profile file name
+ * \return true if succeed
+ *
+ */
+bool TIMING_Save(char *filename)
+{
+  tTiming *timing = &SESSION_Current->timing;
+  tTimingEntry *entry;
+  FILE *fp;
+  uint8_t i;
+
+  if (timing->number == 0)
+    return true;
+  if ((fp = fopen(filename, "w")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't save timing profile: %s", filename);
+    return false;
+  }
+  fprintf(fp, "# updiprog NVM timing profile: key, operation, estimate in us, samples\n");
+  for (i = 0; i < timing->number; i++)
+  {
+    entry = &timing->entries[i];
+    fprintf(fp, "nvm-timing %s %s %u %u\n", entry->key, TIMING_Names[entry->op], entry->estimate_us,
+            entry->samples);
+  }
+  fclose(fp);
+  return true;
+}
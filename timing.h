@@ -0,0 +1,57 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMING_MAX_ENTRIES  (32)
+#define TIMING_KEY_LEN      (16)
+#define TIMING_WEIGHT       (8)         // a new sample moves the estimate by 1/8 of the difference
+#define TIMING_MAX_STEP     (2)         // samples above twice the estimate count as twice the estimate
+#define TIMING_FIRST_POLL   (3)         // first poll at 3/4 of the estimate
+#define TIMING_POLLS        (16)        // poll interval is 1/16 of the estimate
+#define TIMING_TIMEOUT_US   (10000000)  // just to be sure
+#define TIMING_LINE_LEN     (128)
+
+/**< NVM operations with own completion time */
+enum {
+  TIMING_PAGE_WRITE,
+  TIMING_PAGE_ERASE,
+  TIMING_PAGE_ERASE_WRITE,
+  TIMING_EEPROM_WRITE,        // erase and write of byte-erasable memories
+  TIMING_EEPROM_ERASE,
+  TIMING_CHIP_ERASE,
+  TIMING_FUSE_WRITE,
+  TIMING_OPS,
+  TIMING_NONE = TIMING_OPS
+};
+
+typedef struct
+{
+  char      key[TIMING_KEY_LEN];  // signature as hex or device name
+  uint8_t   op;
+  uint32_t  estimate_us;
+  uint32_t  samples;
+} tTimingEntry;
+
+/**< completion times learned from the targets, kept while the session lives */
+typedef struct
+{
+  tTimingEntry entries[TIMING_MAX_ENTRIES];
+  uint8_t   number;
+  char      key[TIMING_KEY_LEN];  // current target, empty until its signature is read
+  uint8_t   pending;              // operation started and not finished yet
+  uint64_t  start;
+} tTiming;
+
+void TIMING_SetSignature(uint8_t *signature);
+uint8_t TIMING_GetOperation(uint8_t command);
+char *TIMING_GetName(uint8_t op);
+void TIMING_Start(uint8_t op);
+uint32_t TIMING_Expected(uint8_t op);
+uint64_t TIMING_Schedule(uint32_t *interval);
+void TIMING_Finish(bool done);
+bool TIMING_Load(char *filename);
+bool TIMING_Save(char *filename);
+
+#endif // TIMING_H
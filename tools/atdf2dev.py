@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Generate updiprog device database lines from Microchip ATDF files.
+
+Usage: atdf2dev.py [--nvm N] FILE_OR_DIR... > devices.db
+
+Directories are searched for *.atdf, e.g. the atdf folder of an unpacked
+device family pack. Only UPDI parts with 16-bit flash addresses are written,
+the database is loaded with "updiprog --device-db devices.db".
+"""
+
+import os
+import sys
+import xml.etree.ElementTree as ET
+
+NAME_LEN = 16
+VENDOR_ID = 0x1E
+
+
+def number(text):
+    return int(text, 0)
+
+
+def short_name(name):
+    # ATtiny817 -> tiny817, ATmega4809 -> mega4809, AVR32DA28 stays
+    if name.startswith("AT"):
+        return name[2:]
+    return name
+
+
+def nvm_version(device, override):
+    if override is not None:
+        return override
+    family = device.get("family", "")
+    if family in ("tinyAVR", "megaAVR"):
+        return 0
+    if family.startswith("AVR D"):
+        return 2
+    if family.startswith("AVR E"):
+        return 3
+    return None
+
+
+def segments(device):
+    found = {}
+    for space in device.iter("address-space"):
+        for segment in space.iter("memory-segment"):
+            found[(space.get("name"), segment.get("name"))] = segment
+    return found
+
+
+def module_offset(device, name):
+    for module in device.iter("module"):
+        if module.get("name") == name:
+            for group in module.iter("register-group"):
+                if group.get("offset") is not None:
+                    return number(group.get("offset"))
+    return 0
+
+
+def signature(device):
+    values = {}
+    for group in device.iter("property-group"):
+        if group.get("name") == "SIGNATURES":
+            for prop in group.iter("property"):
+                values[prop.get("name")] = number(prop.get("value"))
+    try:
+        return (values["SIGNATURE0"] << 16) | (values["SIGNATURE1"] << 8) | values["SIGNATURE2"]
+    except KeyError:
+        return None
+
+
+def convert(path, override):
+    device = ET.parse(path).getroot().find("devices/device")
+    if device is None:
+        raise ValueError("no device")
+    if device.find(".//interface[@type='updi']") is None and device.find(".//interface[@name='UPDI']") is None:
+        raise ValueError("no UPDI interface")
+    name = short_name(device.get("name"))
+    found = segments(device)
+    flash = found.get(("data", "MAPPED_PROGMEM"))
+    progmem = found.get(("prog", "PROGMEM"))
+    sigrow = found.get(("data", "SIGNATURES"))
+    fuses = found.get(("data", "FUSES"))
+    eeprom = found.get(("data", "EEPROM"))
+    userrow = found.get(("data", "USER_SIGNATURES"))
+    sig = signature(device)
+    nvm = nvm_version(device, override)
+    if len(name) >= NAME_LEN:
+        raise ValueError("name is too long")
+    if None in (flash, progmem, sigrow, fuses, sig, nvm) or (sig >> 16) != VENDOR_ID:
+        raise ValueError("memory layout, signature or NVM version is unknown")
+    size = number(progmem.get("size"))
+    if number(flash.get("start")) + size > 0x10000:
+        raise ValueError("flash is above 64 KB of data space")
+    fields = [
+        "device %s" % name,
+        "flash=0x%04X:%d:%d" % (number(flash.get("start")), size, number(progmem.get("pagesize"))),
+        "syscfg=0x%04X" % module_offset(device, "SYSCFG"),
+        "nvmctrl=0x%04X" % module_offset(device, "NVMCTRL"),
+        "sigrow=0x%04X" % number(sigrow.get("start")),
+        "fuses=0x%04X:%d" % (number(fuses.get("start")), number(fuses.get("size"))),
+    ]
+    if userrow is not None:
+        fields.append("userrow=0x%04X:%d" % (number(userrow.get("start")), number(userrow.get("size"))))
+    if module_offset(device, "CRCSCAN") != 0:
+        fields.append("crcscan=0x%04X" % module_offset(device, "CRCSCAN"))
+    if eeprom is not None:
+        fields.append("eeprom=0x%04X:%d:%d" % (number(eeprom.get("start")), number(eeprom.get("size")),
+                                               number(eeprom.get("pagesize", "1"))))
+    fields.append("signature=%06X" % sig)
+    fields.append("nvm=%d" % nvm)
+    return " ".join(fields)
+
+
+def main(argv):
+    override = None
+    paths = []
+    args = iter(argv)
+    for arg in args:
+        if arg == "--nvm":
+            override = int(next(args))
+        else:
+            paths.append(arg)
+    if not paths:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+    files = []
+    for path in paths:
+        if os.path.isdir(path):
+            files += sorted(os.path.join(path, f) for f in os.listdir(path) if f.endswith(".atdf"))
+        else:
+            files.append(path)
+    print("# generated by atdf2dev.py from %d files" % len(files))
+    written = 0
+    for path in files:
+        try:
+            print(convert(path, override))
+            written += 1
+        except (ValueError, ET.ParseError) as e:
+            print("%s: skipped, %s" % (path, e), file=sys.stderr)
+    return 0 if written > 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -58,6 +58,7 @@
 
 #define UPDI_KEY_NVM              "NVMProg "
 #define UPDI_KEY_CHIPERASE        "NVMErase"
+#define UPDI_KEY_UROW             "NVMUs&te"
 
 #define UPDI_ASI_STATUSA_REVID    4
 #define UPDI_ASI_STATUSB_PESIG    0
@@ -72,6 +73,9 @@
 #define UPDI_ASI_SYS_STATUS_UROWPROG    2
 #define UPDI_ASI_SYS_STATUS_LOCKSTATUS  0
 
+#define UPDI_ASI_SYS_CTRLA_UROW_FINAL   1
+#define UPDI_ASI_SYS_CTRLA_CLKREQ       0
+
 #define UPDI_RESET_REQ_VALUE    0x59
 
 // FLASH CONTROLLER
@@ -101,4 +105,15 @@
 
 #define UPDI_SIB_LENGTH               16
 
+// CRCSCAN
+#define UPDI_CRCSCAN_CTRLA      0x00
+#define UPDI_CRCSCAN_CTRLB      0x01
+#define UPDI_CRCSCAN_STATUS     0x02
+
+#define UPDI_CRCSCAN_CTRLA_RESET_BIT    7
+#define UPDI_CRCSCAN_CTRLA_ENABLE_BIT   0
+#define UPDI_CRCSCAN_CTRLB_SRC_FLASH    0x00
+#define UPDI_CRCSCAN_STATUS_OK_BIT      1
+#define UPDI_CRCSCAN_STATUS_BUSY_BIT    0
+
 #endif